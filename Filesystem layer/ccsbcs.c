@@ -0,0 +1,87 @@
+/*------------------------------------------------------------------------*/
+/* Unicode - OEM code bidirectional converter for code page 437 (U.S.)    */
+/*------------------------------------------------------------------------*/
+/* The LFN feature of FatFs needs these two functions. Only the code page */
+/* set in ffconf.h is supported, so the table has no selection. Upper     */
+/* case conversion covers ASCII, Latin-1, Greek and Cyrillic letters,     */
+/* which is all the file names of a music library are expected to use.    */
+/*------------------------------------------------------------------------*/
+
+#include "ff.h"
+
+#if _USE_LFN
+
+#if _CODE_PAGE != 437
+#error ccsbcs.c only has the table of code page 437.
+#endif
+
+/* Unicode of the OEM characters 0x80-0xFF */
+static
+const WCHAR Tbl[] = {
+	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+	0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+	0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+	0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+	0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+	0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+	0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+	0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+	0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+	0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+	0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+	0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+	0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+	0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+	0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+};
+
+
+WCHAR ff_convert (	/* Converted character, Returns zero on error */
+	WCHAR	chr,	/* Character code to be converted */
+	UINT	dir		/* 0: Unicode to OEM code, 1: OEM code to Unicode */
+)
+{
+	WCHAR c;
+
+
+	if (chr < 0x80) {	/* ASCII */
+		c = chr;
+
+	} else {
+		if (dir) {		/* OEM code to Unicode */
+			c = (chr >= 0x100) ? 0 : Tbl[chr - 0x80];
+
+		} else {		/* Unicode to OEM code */
+			for (c = 0; c < 0x80; c++) {
+				if (chr == Tbl[c]) break;
+			}
+			c = (c + 0x80) & 0xFF;
+		}
+	}
+
+	return c;
+}
+
+
+WCHAR ff_wtoupper (	/* Upper converted character */
+	WCHAR chr		/* Input character */
+)
+{
+	if (chr >= 'a' && chr <= 'z')							/* ASCII */
+		return chr - 0x20;
+	if (chr >= 0x00E0 && chr <= 0x00FE && chr != 0x00F7)	/* Latin-1 */
+		return chr - 0x20;
+	if (chr == 0x00FF)
+		return 0x0178;
+	if (chr >= 0x03B1 && chr <= 0x03C9 && chr != 0x03C2)	/* Greek */
+		return chr - 0x20;
+	if (chr >= 0x0430 && chr <= 0x044F)						/* Cyrillic */
+		return chr - 0x20;
+	if (chr >= 0x0450 && chr <= 0x045F)
+		return chr - 0x50;
+
+	return chr;
+}
+
+#endif /* _USE_LFN */
@@ -11,14 +11,97 @@
 //#include "usbdisk.h"	/* Example: USB drive control */
 //#include "atadrive.h"	/* Example: ATA drive control */
 //#include <sdcard.h>		/* Example: MMC/SDC contorl */
+#ifdef _DISK_IMAGE
+#include <stdio.h>
+#include <string.h>
+#else
 #include <stm324xg_eval_sdio_sd.h>
 #include <rgb_led.h>
+#include <utils.h>
+#include <delay.h>
+#endif
 
 /* Definitions of physical drive number for each media */
 #define ATA		1
 #define MMC		0
 #define USB		2
 
+/*
+ * Building with _DISK_IMAGE defined replaces the SD card with a FAT image
+ * file, so that FatFs and this module can be run and measured on a PC (see
+ * benchmarks.c). Every read command is charged a configurable latency, plus a
+ * transfer time per sector, which is added to the modeled_us statistic
+ * instead of actually waiting.
+ */
+#ifdef _DISK_IMAGE
+#define mem_cpy(dst, src, cnt)	memcpy(dst, src, cnt)
+
+static FILE *image;
+static const char *image_path;
+static DWORD command_latency_us, sector_latency_us;
+#endif
+
+/*
+ * In DMA mode the SDIO stream moves words in bursts of 4, so the buffers must
+ * be aligned to 16 bytes (a burst can't cross a 1 KB boundary) and they can't
+ * be in the CCM RAM, which is not connected to the DMA controllers. Sectors
+ * for buffers that don't meet those requirements are read one at a time into
+ * bounce_buffer and copied from there.
+ */
+#if defined (SD_DMA_MODE)
+#define DMA_CAPABLE(buff)	((((DWORD)(buff) & 15) == 0) && \
+							(((DWORD)(buff) & 0xFFFF0000) != 0x10000000))
+#else
+#define DMA_CAPABLE(buff)	1
+#endif
+
+static BYTE bounce_buffer[512] __attribute__ ((aligned (16)));
+
+static DISK_CALLBACK read_done;		/* Completion function of disk_read_start */
+
+static DSTATS stats;
+
+static DBUSINFO bus_info;		/* Bus negotiated at the last disk_initialize */
+#ifndef _DISK_IMAGE
+static void measure_bus (void);
+#endif
+
+/*
+ * Error recovery. A failed read is retried up to _DISK_READ_RETRIES times,
+ * waiting _DISK_RETRY_DELAY_MS before the first retry and twice as long
+ * before every following one, so that a marginal card costs some throughput
+ * instead of stopping the playback. CRC errors usually mean that the card
+ * can't keep up with the bus clock, so after _DISK_CRC_DOWNGRADE of them in
+ * a row the clock is halved (see SD_DecreaseBusClock). Every error is counted
+ * by class in "errors" (disk_get_errors).
+ */
+static DERRSTATS errors;
+#ifndef _DISK_IMAGE
+static DWORD consecutive_crc_errors;
+#endif
+
+/*
+ * The sector cache. Browsing the file manager and changing tracks read the
+ * same FAT and directory sectors again and again, always one sector at a time
+ * through the FatFs window, while file data is mostly read in multiple sector
+ * requests. So single sector reads are kept here and served from RAM when
+ * they are requested again, replacing the least recently used sector when a
+ * new one has to be stored. An entry whose last_use is 0 is empty.
+ */
+#if _DISK_CACHE_SECTORS
+static BYTE cache_data[_DISK_CACHE_SECTORS][512] __attribute__ ((aligned (16)));
+static DWORD cache_sector[_DISK_CACHE_SECTORS];
+static DWORD cache_last_use[_DISK_CACHE_SECTORS];
+static DWORD cache_clock;
+
+static void clear_cache (void)
+{
+	for (cache_clock = 0; cache_clock < _DISK_CACHE_SECTORS; ++cache_clock)
+		cache_last_use[cache_clock] = 0;
+	cache_clock = 0;
+}
+#endif
+
 
 /*-----------------------------------------------------------------------*/
 /* Inidialize a Drive                                                    */
@@ -58,13 +141,28 @@ DSTATUS disk_initialize (
 	DSTATUS stat = RES_ERROR;
 
 	if (pdrv == MMC) {
+#if _DISK_CACHE_SECTORS
+		/* It may be a different card now */
+		clear_cache();
+#endif
+
+#ifdef _DISK_IMAGE
+		if (image) fclose(image);
+		image = image_path ? fopen(image_path, "r+b") : 0;
+		if (!image && image_path) image = fopen(image_path, "rb");
+		if (image) {
+			stat = RES_OK;
+		}
+#else
 		int result = SD_Init();
 
 		// translate the reslut code here
 
 		if (result == SD_OK) {
 			stat = RES_OK;
+			measure_bus();
 		}
+#endif
 	}
 
 	return stat;
@@ -110,9 +208,14 @@ DSTATUS disk_status (
 	DSTATUS stat = RES_ERROR;
 
 	if (pdrv == MMC) {
+#ifdef _DISK_IMAGE
+		if (image)
+			stat = RES_OK;
+#else
 		SDCardState state = SD_GetState();
 		if (state != SD_CARD_ERROR || state != SD_CARD_DISCONNECTED)
 			stat = RES_OK;
+#endif
 	}
 
 	return stat;
@@ -124,6 +227,176 @@ DSTATUS disk_status (
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
+#ifndef _DISK_IMAGE
+/*
+ * Only CRC errors in a row lead to a downgrade, any other error breaks the
+ * row like a success does.
+ */
+static void count_error (SD_Error error)
+{
+	if (error != SD_DATA_CRC_FAIL && error != SD_CMD_CRC_FAIL)
+		consecutive_crc_errors = 0;
+
+	switch (error) {
+	case SD_DATA_CRC_FAIL:
+	case SD_CMD_CRC_FAIL:
+		++errors.crc_errors;
+		++consecutive_crc_errors;
+		break;
+	case SD_DATA_TIMEOUT:
+	case SD_CMD_RSP_TIMEOUT:
+		++errors.timeouts;
+		break;
+	case SD_RX_OVERRUN:
+	case SD_TX_UNDERRUN:
+		++errors.fifo_errors;
+		break;
+	default:
+		++errors.other_errors;
+		break;
+	}
+}
+
+static DWORD bus_clock_khz (void)
+{
+	SD_BusInfo sd_bus;
+
+	SD_GetBusInfo(&sd_bus);
+	return sd_bus.ClockKHz;
+}
+#endif
+
+/*
+ * FatFs asks for several sectors at once when it reads whole sectors of a
+ * file directly into the caller's buffer. Those are contiguous on the card,
+ * so they are fetched with one CMD18 instead of paying the command and access
+ * latency for each.
+ */
+static DRESULT read_sectors (BYTE *buff, DWORD sector, UINT count)
+{
+	DRESULT res = RES_OK;
+
+	++stats.read_commands;
+	stats.sectors_read += count;
+
+#ifdef _DISK_IMAGE
+	stats.modeled_us += command_latency_us + count * sector_latency_us;
+	if (!image || fseek(image, (long)sector * 512, SEEK_SET) ||
+			fread(buff, 512, count, image) != count) {
+		res = RES_ERROR;
+	}
+#else
+	SD_Error error;
+	int attempt;
+
+	for (attempt = 0; ; ++attempt) {
+		if (count == 1) {
+			error = SD_ReadBlock((uint8_t*)buff, sector * 512, 512);
+		}
+		else {
+			error = SD_ReadMultiBlocks((uint8_t*)buff, sector * 512, 512, count);
+		}
+#if defined (SD_DMA_MODE)
+		if (error == SD_OK) {
+			error = SD_WaitReadOperation();
+		}
+#endif
+		if (error == SD_OK) {
+			consecutive_crc_errors = 0;
+			break;
+		}
+
+		count_error(error);
+		if (consecutive_crc_errors >= _DISK_CRC_DOWNGRADE) {
+			consecutive_crc_errors = 0;
+			if (SD_DecreaseBusClock() == SD_OK) {
+				++errors.clock_downgrades;
+				bus_info.clock_khz = bus_clock_khz();
+			}
+		}
+		if (attempt == _DISK_READ_RETRIES || !SDCard_present()) break;
+		++errors.retries;
+		Delay_ms(_DISK_RETRY_DELAY_MS << attempt);
+	}
+
+	if (error == SD_OK) {
+		if (attempt) ++errors.recovered;
+	}
+	else {
+		++errors.failed;
+		res = RES_ERROR;
+	}
+#endif
+	return res;
+}
+
+#ifndef _DISK_IMAGE
+/*
+ * Records the bus settings that SD_Init() negotiated with the card and times
+ * _DISK_BUS_TEST_READS multiple sector reads from the start of the card, so
+ * the throughput actually obtained with them is known. The sector cache is
+ * used as the buffer and is emptied afterwards, so without it there's no
+ * measurement. The cycle counter is enabled at start-up.
+ */
+static void measure_bus (void)
+{
+	SD_BusInfo sd_bus;
+
+	SD_GetBusInfo(&sd_bus);
+	bus_info.bus_width = sd_bus.BusWidth;
+	bus_info.high_speed = sd_bus.HighSpeed;
+	bus_info.clock_khz = sd_bus.ClockKHz;
+	bus_info.read_kbps = 0;
+
+#if _DISK_CACHE_SECTORS
+	int i;
+	uint32_t us;
+
+	uint32_t start = get_cycles();
+	for (i = 0; i < _DISK_BUS_TEST_READS; ++i) {
+		if (read_sectors(cache_data[0], 0, _DISK_CACHE_SECTORS) != RES_OK) break;
+	}
+	us = cycles_to_us(get_cycles() - start);
+	clear_cache();
+	if (i < _DISK_BUS_TEST_READS) return;
+	if (us == 0) us = 1;
+	bus_info.read_kbps = (_DISK_BUS_TEST_READS * _DISK_CACHE_SECTORS / 2) * 1000000 / us;
+#endif
+}
+#endif
+
+#if _DISK_CACHE_SECTORS
+static DRESULT read_cached (BYTE *buff, DWORD sector)
+{
+	DRESULT res;
+	int i, entry = 0;
+
+	++cache_clock;
+
+	for (i = 0; i < _DISK_CACHE_SECTORS; ++i) {
+		if (cache_last_use[i] && cache_sector[i] == sector) {
+			cache_last_use[i] = cache_clock;
+			++stats.cache_hits;
+			mem_cpy(buff, cache_data[i], 512);
+			return RES_OK;
+		}
+		if (cache_last_use[i] < cache_last_use[entry]) entry = i;
+	}
+
+	++stats.cache_misses;
+	res = read_sectors(cache_data[entry], sector, 1);
+	if (res == RES_OK) {
+		cache_sector[entry] = sector;
+		cache_last_use[entry] = cache_clock;
+		mem_cpy(buff, cache_data[entry], 512);
+	}
+	else {
+		cache_last_use[entry] = 0;
+	}
+	return res;
+}
+#endif
+
 DRESULT disk_read (
 	BYTE pdrv,		/* Physical drive nmuber (0..) */
 	BYTE *buff,		/* Data buffer to store read data */
@@ -164,20 +437,34 @@ DRESULT disk_read (
 	}
 	return RES_PARERR;*/
 
-	DRESULT res = RES_ERROR;
-	SD_Error error = SD_OK;
-
-	sector *= 512;
+	DRESULT res = RES_PARERR;
 
 	if (pdrv == MMC) {
-		while (count > 0 && error == SD_OK) {
-			error = SD_ReadBlock((uint8_t*)buff, sector, 512);
-			sector += 512;
-			buff += 512;
-			--count;
+#ifndef _DISK_IMAGE
+		/* Let a transfer started by disk_read_start finish first */
+		if (SD_IsTransferPending())
+			SD_WaitReadOperation();
+#endif
+		read_done = 0;
+
+#if _DISK_CACHE_SECTORS
+		if (count == 1) {
+			res = read_cached(buff, sector);
 		}
-		if (error == SD_OK) {
+		else
+#endif
+		if (DMA_CAPABLE(buff)) {
+			res = read_sectors(buff, sector, count);
+		}
+		else {
 			res = RES_OK;
+			while (count > 0 && res == RES_OK) {
+				res = read_sectors(bounce_buffer, sector, 1);
+				mem_cpy(buff, bounce_buffer, 512);
+				++sector;
+				buff += 512;
+				--count;
+			}
 		}
 	}
 
@@ -186,11 +473,216 @@ DRESULT disk_read (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Start Reading Sector(s) in Background                                 */
+/*-----------------------------------------------------------------------*/
+
+/*
+ * Starts reading sectors with DMA and returns immediately, "done" will be
+ * called from the interrupt handler once the data is in the buffer. Only one
+ * transfer can be going on at a time: the buffer must be DMA capable and it
+ * can't be touched until "done" is called or disk_busy() returns 0. Calls to
+ * disk_read meanwhile wait for the transfer to finish. In polling mode the
+ * read is done right away and "done" is called before returning.
+ */
+
+static void read_finished (DRESULT res)
+{
+	DISK_CALLBACK done = read_done;
+
+	read_done = 0;
+	if (done) done(res);
+}
+
+#ifndef _DISK_IMAGE
+static void transfer_finished (SD_Error error)
+{
+	/*
+	 * The callback is for this transfer only: the synchronous ones that
+	 * follow count their errors themselves. No retries from the interrupt
+	 * handler, disk_read does them.
+	 */
+	SD_SetTransferCallback(0);
+	if (error != SD_OK) count_error(error);
+	else consecutive_crc_errors = 0;
+	read_finished(error == SD_OK ? RES_OK : RES_ERROR);
+}
+#endif
+
+DRESULT disk_read_start (
+	BYTE pdrv,			/* Physical drive nmuber (0..) */
+	BYTE *buff,			/* Data buffer to store read data */
+	DWORD sector,		/* Sector address (LBA) */
+	UINT count,			/* Number of sectors to read */
+	DISK_CALLBACK done	/* Function called when the read is complete */
+)
+{
+	if (pdrv != MMC || !DMA_CAPABLE(buff) || count == 0) return RES_PARERR;
+	if (disk_busy(pdrv)) return RES_NOTRDY;
+
+	read_done = done;
+
+#if defined (_DISK_IMAGE) || !defined (SD_DMA_MODE)
+	read_finished(read_sectors(buff, sector, count));
+#else
+	SD_Error error;
+
+	SD_SetTransferCallback(transfer_finished);
+
+	if (count == 1) {
+		error = SD_ReadBlock((uint8_t*)buff, sector * 512, 512);
+	}
+	else {
+		error = SD_ReadMultiBlocks((uint8_t*)buff, sector * 512, 512, count);
+	}
+
+	if (error != SD_OK) {
+		SD_SetTransferCallback(0);
+		read_done = 0;
+		return RES_ERROR;
+	}
+	++stats.read_commands;
+	stats.sectors_read += count;
+#endif
+	return RES_OK;
+}
+
+int disk_busy (
+	BYTE pdrv		/* Physical drive nmuber (0..) */
+)
+{
+#ifdef _DISK_IMAGE
+	(void)pdrv;
+	return 0;
+#else
+	return pdrv == MMC && SD_IsTransferPending();
+#endif
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Access Statistics                                                 */
+/*-----------------------------------------------------------------------*/
+
+void disk_get_stats (
+	BYTE pdrv,		/* Physical drive nmuber (0..) */
+	DSTATS *st		/* Where to copy the statistics */
+)
+{
+	if (pdrv == MMC) mem_cpy(st, &stats, sizeof(DSTATS));
+}
+
+void disk_reset_stats (
+	BYTE pdrv		/* Physical drive nmuber (0..) */
+)
+{
+	if (pdrv == MMC) {
+		stats.read_commands = stats.sectors_read = 0;
+		stats.cache_hits = stats.cache_misses = 0;
+		stats.modeled_us = 0;
+	}
+}
+
+void disk_get_errors (
+	BYTE pdrv,		/* Physical drive nmuber (0..) */
+	DERRSTATS *err	/* Where to copy the error counters */
+)
+{
+	if (pdrv == MMC) mem_cpy(err, &errors, sizeof(DERRSTATS));
+}
+
+void disk_reset_errors (
+	BYTE pdrv		/* Physical drive nmuber (0..) */
+)
+{
+	if (pdrv == MMC) {
+		errors.crc_errors = errors.timeouts = 0;
+		errors.fifo_errors = errors.other_errors = 0;
+		errors.retries = errors.recovered = errors.failed = 0;
+		errors.clock_downgrades = 0;
+	}
+}
+
+void disk_get_bus_info (
+	BYTE pdrv,		/* Physical drive nmuber (0..) */
+	DBUSINFO *info	/* Where to copy the bus settings */
+)
+{
+	if (pdrv == MMC) mem_cpy(info, &bus_info, sizeof(DBUSINFO));
+}
+
+
+
+#ifdef _DISK_IMAGE
+/*-----------------------------------------------------------------------*/
+/* Select the Image File and its Latency                                 */
+/*-----------------------------------------------------------------------*/
+
+void disk_image_open (
+	const char *path	/* Image file opened by the next disk_initialize */
+)
+{
+	image_path = path;
+}
+
+void disk_set_latency (
+	DWORD command_us,	/* Modeled latency of every read command */
+	DWORD sector_us		/* Modeled transfer time of every sector */
+)
+{
+	command_latency_us = command_us;
+	sector_latency_us = sector_us;
+}
+#endif
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Write Sector(s)                                                       */
 /*-----------------------------------------------------------------------*/
 
 #if _USE_WRITE
+static DRESULT write_sectors (const BYTE *buff, DWORD sector, UINT count)
+{
+	DRESULT res = RES_OK;
+
+#ifdef _DISK_IMAGE
+	if (!image || fseek(image, (long)sector * 512, SEEK_SET) ||
+			fwrite(buff, 512, count, image) != count || fflush(image)) {
+		res = RES_ERROR;
+	}
+#else
+	SD_Error error;
+
+	if (count == 1) {
+		error = SD_WriteBlock((uint8_t*)buff, sector * 512, 512);
+	}
+	else {
+		error = SD_WriteMultiBlocks((uint8_t*)buff, sector * 512, 512, count);
+	}
+#if defined (SD_DMA_MODE)
+	if (error == SD_OK) {
+		error = SD_WaitWriteOperation();
+	}
+#endif
+	if (error == SD_OK) {
+		/* Wait until the card has programmed the data */
+		SDTransferState state;
+		while ((state = SD_GetStatus()) == SD_TRANSFER_BUSY && SDCard_present());
+		if (state != SD_TRANSFER_OK) error = SD_ERROR;
+	}
+	if (error != SD_OK) {
+		count_error(error);
+		res = RES_ERROR;
+	}
+	else {
+		consecutive_crc_errors = 0;
+	}
+#endif
+	return res;
+}
+
 DRESULT disk_write (
 	BYTE pdrv,			/* Physical drive nmuber (0..) */
 	const BYTE *buff,	/* Data to be written */
@@ -198,14 +690,14 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write (1..128) */
 )
 {
-	DRESULT res = RES_OK;
-	//int result;
+	/*DRESULT res;
+	int result;
 
 	switch (pdrv) {
 	case ATA :
 		// translate the arguments here
 
-		//result = ATA_disk_write(buff, sector, count);
+		result = ATA_disk_write(buff, sector, count);
 
 		// translate the reslut code here
 
@@ -214,7 +706,7 @@ DRESULT disk_write (
 	case MMC :
 		// translate the arguments here
 
-		//result = MMC_disk_write(buff, sector, count);
+		result = MMC_disk_write(buff, sector, count);
 
 		// translate the reslut code here
 
@@ -223,13 +715,50 @@ DRESULT disk_write (
 	case USB :
 		// translate the arguments here
 
-		//result = USB_disk_write(buff, sector, count);
+		result = USB_disk_write(buff, sector, count);
 
 		// translate the reslut code here
 
 		return res;
 	}
-	return RES_PARERR;
+	return RES_PARERR;*/
+
+	DRESULT res = RES_PARERR;
+
+	if (pdrv == MMC) {
+#ifndef _DISK_IMAGE
+		/* Let a transfer started by disk_read_start finish first */
+		if (SD_IsTransferPending())
+			SD_WaitReadOperation();
+#endif
+		read_done = 0;
+
+#if _DISK_CACHE_SECTORS
+		/* Cached copies of the written sectors are out of date now */
+		int i;
+		for (i = 0; i < _DISK_CACHE_SECTORS; ++i) {
+			if (cache_last_use[i] && cache_sector[i] >= sector &&
+					cache_sector[i] < sector + count)
+				cache_last_use[i] = 0;
+		}
+#endif
+
+		if (DMA_CAPABLE(buff)) {
+			res = write_sectors(buff, sector, count);
+		}
+		else {
+			res = RES_OK;
+			while (count > 0 && res == RES_OK) {
+				mem_cpy(bounce_buffer, (void*)buff, 512);
+				res = write_sectors(bounce_buffer, sector, 1);
+				++sector;
+				buff += 512;
+				--count;
+			}
+		}
+	}
+
+	return res;
 }
 #endif
 
@@ -281,6 +810,15 @@ DRESULT disk_ioctl (
 	DRESULT result = RES_ERROR;
 
 	if (pdrv == MMC) {
+#ifdef _DISK_IMAGE
+		if (cmd == GET_SECTOR_SIZE) {
+			*((WORD*)buff) = 512;
+			result = RES_OK;
+		}
+		else if (cmd == CTRL_SYNC) {
+			result = RES_OK;
+		}
+#else
 		if (cmd == GET_SECTOR_SIZE) {
 			uint32_t size = SD_GetSectorSize();
 			if (size == 512 || size == 1024 || size == 2048 || size == 4096) {
@@ -288,6 +826,11 @@ DRESULT disk_ioctl (
 				result = RES_OK;
 			}
 		}
+		else if (cmd == CTRL_SYNC) {
+			/* disk_write returns once the card has programmed the data */
+			result = RES_OK;
+		}
+#endif
 		else {
 			result = RES_PARERR;
 		}
@@ -295,3 +838,20 @@ DRESULT disk_ioctl (
 	return result;
 }
 #endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Current Time for the File Timestamps                              */
+/*-----------------------------------------------------------------------*/
+
+/*
+ * The RTC of the board is not set up, so every file written is stamped with
+ * the same date, 1 January 2014 00:00.
+ */
+DWORD get_fattime (void)
+{
+	return ((DWORD)(2014 - 1980) << 25)	/* Year */
+			| ((DWORD)1 << 21)			/* Month */
+			| ((DWORD)1 << 16);			/* Day */
+}
@@ -12,6 +12,14 @@ extern "C" {
 #define _USE_WRITE	1	/* 1: Enable disk_write function */
 #define _USE_IOCTL	1	/* 1: Enable disk_ioctl fucntion */
 
+#define _DISK_CACHE_SECTORS	16	/* Number of sectors kept in the LRU sector cache
+								/  for single sector reads (0: Disable the cache) */
+#define _DISK_BUS_TEST_READS	4	/* Reads of _DISK_CACHE_SECTORS sectors timed by
+								/  disk_initialize to measure the bus throughput */
+#define _DISK_READ_RETRIES	4	/* Retries of a failed read before giving up */
+#define _DISK_RETRY_DELAY_MS	2	/* Wait before the first retry, doubled every time */
+#define _DISK_CRC_DOWNGRADE	2	/* CRC errors in a row that halve the bus clock */
+
 #include "integer.h"
 
 
@@ -27,6 +35,38 @@ typedef enum {
 	RES_PARERR		/* 4: Invalid Parameter */
 } DRESULT;
 
+/* Disk access statistics (disk_get_stats) */
+typedef struct {
+	DWORD	read_commands;	/* Read commands issued to the media */
+	DWORD	sectors_read;	/* Sectors transferred from the media */
+	DWORD	cache_hits;		/* Sector reads served from the sector cache */
+	DWORD	cache_misses;	/* Sector reads that missed the sector cache */
+	DWORD	modeled_us;		/* Modeled access time (image backend only) */
+} DSTATS;
+
+/* Read errors by class and what was done about them (disk_get_errors) */
+typedef struct {
+	DWORD	crc_errors;		/* Command or data CRC failures */
+	DWORD	timeouts;		/* Command response or data timeouts */
+	DWORD	fifo_errors;	/* SDIO FIFO overruns and underruns */
+	DWORD	other_errors;	/* Any other error reported by the card or the driver */
+	DWORD	retries;		/* Reads sent again after an error */
+	DWORD	recovered;		/* Reads that succeeded after retrying */
+	DWORD	failed;			/* Reads that failed after all the retries */
+	DWORD	clock_downgrades;	/* Times the bus clock was halved */
+} DERRSTATS;
+
+/* Bus negotiated with the card (disk_get_bus_info) */
+typedef struct {
+	BYTE	bus_width;		/* Data bus width in bits (1 or 4) */
+	BYTE	high_speed;		/* 1 if the card is in High Speed mode */
+	DWORD	clock_khz;		/* Bus clock */
+	DWORD	read_kbps;		/* Measured multiple sector read throughput (KB/s) */
+} DBUSINFO;
+
+/* Completion function of disk_read_start (called from interrupt context) */
+typedef void (*DISK_CALLBACK) (DRESULT res);
+
 
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
@@ -37,6 +77,17 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE*buff, DWORD sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+DRESULT disk_read_start (BYTE pdrv, BYTE* buff, DWORD sector, UINT count, DISK_CALLBACK done);
+int disk_busy (BYTE pdrv);
+void disk_get_stats (BYTE pdrv, DSTATS* stats);
+void disk_reset_stats (BYTE pdrv);
+void disk_get_errors (BYTE pdrv, DERRSTATS* errors);
+void disk_reset_errors (BYTE pdrv);
+void disk_get_bus_info (BYTE pdrv, DBUSINFO* info);
+#ifdef _DISK_IMAGE
+void disk_image_open (const char* path);
+void disk_set_latency (DWORD command_us, DWORD sector_us);
+#endif
 
 
 /* Disk Status Bits (DSTATUS) */
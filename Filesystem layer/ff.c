@@ -2541,6 +2541,57 @@ FRESULT f_open (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Open a File for Reading from its Start Cluster and Size               */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_openchain (
+	FIL* fp,			/* Pointer to the blank file object */
+	DWORD sclust,		/* Start cluster of the file (from a file opened before) */
+	DWORD fsize			/* Size of the file */
+)
+{
+	FRESULT res;
+	FATFS* fs;
+	const TCHAR* path = _T("");
+
+
+	if (!fp) return FR_INVALID_OBJECT;
+	fp->fs = 0;			/* Clear file object */
+
+	/* Get logical drive number (the default drive) */
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		if (sclust == 1 || sclust >= fs->n_fatent || (!sclust && fsize))
+			res = FR_INT_ERR;				/* Not a cluster of this volume */
+	}
+	if (res == FR_OK) {
+		fp->flag = FA_READ;					/* Read only, there is no directory entry to update */
+		fp->err = 0;
+		fp->sclust = sclust;
+		fp->fsize = fsize;
+		fp->fptr = 0;
+		fp->dsect = 0;
+		fp->dir_sect = 0;
+		fp->dir_ptr = 0;
+#if _USE_FASTSEEK
+		fp->cltbl = 0;						/* Normal seek mode */
+#endif
+#if _FS_LOCK
+		fp->lockid = 0;
+		res = FR_INT_ERR;					/* Files opened this way can't be locked */
+#else
+		fp->fs = fs;	 					/* Validate file object */
+		fp->id = fs->id;
+#endif
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read File                                                             */
 /*-----------------------------------------------------------------------*/
@@ -2904,6 +2955,24 @@ FRESULT f_chdir (
 }
 
 
+FRESULT f_chcluster (
+	DWORD sclust		/* Start cluster of the directory (0:Root dir) */
+)
+{
+	FRESULT res;
+	FATFS* fs;
+	const TCHAR* path = _T("");
+
+
+	/* Get logical drive number (the default drive) */
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK)
+		fs->cdir = sclust;				/* Trust the caller, no path is followed */
+
+	LEAVE_FF(fs, res);
+}
+
+
 #if _FS_RPATH >= 2
 FRESULT f_getcwd (
 	TCHAR* buff,	/* Pointer to the directory path */
@@ -3141,6 +3210,48 @@ FRESULT f_lseek (
 
 
 
+#if _USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Get Physical Sectors of a File Area with the Link Map Table           */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_mapsect (
+	FIL* fp,		/* Pointer to the file object with a CLMT */
+	DWORD ofs,		/* File offset to be converted to sector# */
+	DWORD* sect,	/* Pointer to the variable to return the sector# */
+	UINT* nsect		/* Pointer to the variable to return the number of contiguous sectors */
+)
+{
+	FRESULT res;
+	DWORD cl, ncl, *tbl;
+	UINT sc;
+
+
+	res = validate(fp);					/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (!fp->cltbl || ofs >= fp->fsize)	/* Check the CLMT and the offset */
+		LEAVE_FF(fp->fs, FR_INVALID_PARAMETER);
+
+	tbl = fp->cltbl + 1;				/* Find the fragment of the offset */
+	sc = (UINT)(ofs / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+	cl = ofs / SS(fp->fs) / fp->fs->csize;	/* Cluster order from top of the file */
+	for (;;) {
+		ncl = *tbl++;
+		if (!ncl) ABORT(fp->fs, FR_INT_ERR);
+		if (cl < ncl) break;
+		cl -= ncl; tbl++;
+	}
+	*sect = clust2sect(fp->fs, cl + *tbl);
+	if (!*sect) ABORT(fp->fs, FR_INT_ERR);
+	*sect += sc;
+	*nsect = (UINT)((ncl - cl) * fp->fs->csize - sc);	/* Sectors to the end of the fragment */
+
+	LEAVE_FF(fp->fs, FR_OK);
+}
+#endif
+
+
+
 #if _FS_MINIMIZE <= 1
 /*-----------------------------------------------------------------------*/
 /* Create a Directory Object                                             */
@@ -3198,6 +3309,72 @@ FRESULT f_opendir (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Create a Directory Object from its Start Cluster                      */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_opencluster (
+	DIR* dp,			/* Pointer to directory object to create */
+	DWORD sclust		/* Start cluster of the directory (0:Root dir) */
+)
+{
+	FRESULT res;
+	FATFS* fs;
+	const TCHAR* path = _T("");
+
+
+	if (!dp) return FR_INVALID_OBJECT;
+
+	/* Get logical drive number (the default drive) */
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		dp->fs = fs;
+		dp->sclust = sclust;
+		dp->id = fs->id;
+		res = dir_sdi(dp, 0);					/* Rewind directory */
+#if _FS_LOCK
+		if (res == FR_OK) {
+			if (dp->sclust) {
+				dp->lockid = inc_lock(dp, 0);	/* Lock the sub directory */
+				if (!dp->lockid)
+					res = FR_TOO_MANY_OPEN_FILES;
+			} else {
+				dp->lockid = 0;	/* Root directory need not to be locked */
+			}
+		}
+#endif
+		if (res == FR_NO_FILE) res = FR_NO_PATH;
+	}
+	if (res != FR_OK) dp->fs = 0;		/* Invalidate the directory object if function faild */
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Move the Read Index of a Directory Object                             */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_seekdir (
+	DIR* dp,			/* Pointer to the open directory object */
+	WORD index			/* Index of the entry to be read next (DIR.item) */
+)
+{
+	FRESULT res;
+
+
+	res = validate(dp);					/* Check validity of the object */
+	if (res == FR_OK)
+		res = dir_sdi(dp, index);
+
+	LEAVE_FF(dp->fs, res);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Close Directory                                                       */
 /*-----------------------------------------------------------------------*/
@@ -3256,6 +3433,7 @@ FRESULT f_readdir (
 			}
 			if (res == FR_OK) {				/* A valid entry is found */
 				get_fileinfo(dp, fno);		/* Get the object information */
+				dp->item = dp->index;		/* Keep the index of the entry */
 				res = dir_next(dp, 0);		/* Increment index for next */
 				if (res == FR_NO_FILE) {
 					dp->sect = 0;
@@ -25,8 +25,14 @@ typedef int				INT;
 typedef unsigned int	UINT;
 
 /* These types MUST be 32 bit */
+#ifdef _DISK_IMAGE		/* PC build with the disk image backend (diskio.c) */
+#include <stdint.h>
+typedef int32_t			LONG;
+typedef uint32_t		DWORD;
+#else
 typedef long			LONG;
 typedef unsigned long	DWORD;
+#endif
 
 #endif
 
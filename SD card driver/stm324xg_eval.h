@@ -221,6 +221,10 @@ typedef enum
   * @brief  SDIO Data Transfer Frequency (25MHz max) 
   */
 #define SDIO_TRANSFER_CLK_DIV            ((uint8_t)0x0) 
+/** 
+  * @brief  Slowest SDIO Data Transfer Frequency used after errors (3MHz)
+  */
+#define SDIO_SLOWEST_TRANSFER_CLK_DIV    ((uint8_t)0xE)
 
 #define SD_SDIO_DMA                   DMA2
 #define SD_SDIO_DMA_CLK               RCC_AHB1Periph_DMA2
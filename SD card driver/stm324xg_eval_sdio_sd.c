@@ -300,6 +300,16 @@
 #define SD_SINGLE_BUS_SUPPORT           ((uint32_t)0x00010000)
 #define SD_CARD_LOCKED                  ((uint32_t)0x02000000)
 
+/** 
+  * @brief  CMD6 arguments to check and to switch to the High Speed function
+  *         of group 1, leaving the other groups unchanged.
+  */
+#define SD_SWITCH_CHECK_HIGH_SPEED      ((uint32_t)0x00FFFFF1)
+#define SD_SWITCH_SET_HIGH_SPEED        ((uint32_t)0x80FFFFF1)
+
+#define SD_STATUS_BUS_WIDTH_4B          ((uint8_t)0x02)
+#define SD_SDIOCLK_KHZ                  ((uint32_t)48000)
+
 #define SD_DATATIMEOUT                  ((uint32_t)0xFFFFFFFF)
 #define SD_0TO7BITS                     ((uint32_t)0x000000FF)
 #define SD_8TO15BITS                    ((uint32_t)0x0000FF00)
@@ -340,10 +350,14 @@
 
 static uint32_t CardType =  SDIO_STD_CAPACITY_SD_CARD_V1_1;
 static uint32_t CSD_Tab[4], CID_Tab[4], RCA = 0;
-static uint8_t SDSTATUS_Tab[16];
+static uint8_t SDSTATUS_Tab[64];
 __IO uint32_t StopCondition = 0;
 __IO SD_Error TransferError = SD_OK;
 __IO uint32_t TransferEnd = 0, DMAEndOfTransfer = 0;
+static __IO uint32_t TransferPending = 0;
+static __IO SD_Error TransferStatus = SD_OK;
+static SD_TransferCallback TransferCallback = 0;
+static SD_BusInfo BusInfo;
 SD_CardInfo SDCardInfo;
 
 SDIO_InitTypeDef SDIO_InitStructure;
@@ -366,6 +380,15 @@ static SD_Error CmdResp6Error(uint8_t cmd, uint16_t *prca);
 static SD_Error SDEnWideBus(FunctionalState NewState);
 static SD_Error IsCardProgramming(uint8_t *pstatus);
 static SD_Error FindSCR(uint16_t rca, uint32_t *pscr);
+static void SDConfigureBus(uint8_t ClockDiv, uint32_t ClockBypass, uint32_t BusWide);
+static SD_Error SDSwitchFunction(uint32_t argument, uint8_t *pstatus);
+static SD_Error SDEnHighSpeed(void);
+static SD_Error SDNegotiateBus(void);
+#if defined (SD_DMA_MODE)
+static void NVIC_Configuration(void);
+static void CompleteTransfer(void);
+static SD_Error WaitTransfer(void);
+#endif
 uint8_t convert_from_bytes_to_power_of_two(uint16_t NumberOfBytes);
   
 /**
@@ -400,6 +423,10 @@ SD_Error SD_Init(void)
   /* SDIO Peripheral Low Level Init */
   SD_LowLevel_Init();
 
+#if defined (SD_DMA_MODE)
+  NVIC_Configuration();
+#endif
+
   SDIO_DeInit();
 
   errorstatus = SD_PowerON();
@@ -440,12 +467,58 @@ SD_Error SD_Init(void)
 
   if (errorstatus == SD_OK)
   {
-    errorstatus = SD_EnableWideBusOperation(SDIO_BusWide_4b);
+    errorstatus = SDNegotiateBus();
   }  
 
   return(errorstatus);
 }
 
+/**
+  * @brief  Returns the bus settings negotiated with the card by SD_Init().
+  * @param  businfo: pointer to a SD_BusInfo structure that receives them.
+  * @retval None
+  */
+void SD_GetBusInfo(SD_BusInfo *businfo)
+{
+  *businfo = BusInfo;
+}
+
+/**
+  * @brief  Halves the SDIO clock, for cards that give CRC errors at the
+  *         current speed. The first step just leaves the 48MHz High Speed
+  *         clock for the default 24MHz one. The bus width is kept.
+  * @param  None
+  * @retval SD_Error: SD_OK if the clock was lowered, SD_UNSUPPORTED_FEATURE
+  *         if it already was at SDIO_SLOWEST_TRANSFER_CLK_DIV.
+  */
+SD_Error SD_DecreaseBusClock(void)
+{
+  uint32_t clockdiv = SDIO_InitStructure.SDIO_ClockDiv;
+
+  if (SDIO_InitStructure.SDIO_ClockBypass == SDIO_ClockBypass_Enable)
+  {
+    clockdiv = SDIO_TRANSFER_CLK_DIV;
+  }
+  else if (clockdiv >= SDIO_SLOWEST_TRANSFER_CLK_DIV)
+  {
+    return(SD_UNSUPPORTED_FEATURE);
+  }
+  else
+  {
+    /*!< SDIOCLK / (2 * ClockDiv + 4) is half of SDIOCLK / (ClockDiv + 2) */
+    clockdiv = 2 * clockdiv + 2;
+    if (clockdiv > SDIO_SLOWEST_TRANSFER_CLK_DIV)
+    {
+      clockdiv = SDIO_SLOWEST_TRANSFER_CLK_DIV;
+    }
+  }
+
+  SDConfigureBus((uint8_t)clockdiv, SDIO_ClockBypass_Disable, SDIO_InitStructure.SDIO_BusWide);
+  BusInfo.ClockKHz = SD_SDIOCLK_KHZ / (clockdiv + 2);
+
+  return(SD_OK);
+}
+
 /**
   * @brief  Gets the cuurent sd card data transfer status.
   * @param  None
@@ -1270,6 +1343,8 @@ SD_Error SD_ReadBlock(uint8_t *readbuff, uint32_t ReadAddr, uint16_t BlockSize)
   SDIO_ClearFlag(SDIO_STATIC_FLAGS);
 
 #elif defined (SD_DMA_MODE)
+    DMAEndOfTransfer = 0;
+    TransferPending = 1;
     SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND | SDIO_IT_RXOVERR | SDIO_IT_STBITERR, ENABLE);
     SDIO_DMACmd(ENABLE);
     SD_LowLevel_DMA_RxConfig((uint32_t *)readbuff, BlockSize);
@@ -1296,6 +1371,10 @@ SD_Error SD_ReadBlock(uint8_t *readbuff, uint32_t ReadAddr, uint16_t BlockSize)
 SD_Error SD_ReadMultiBlocks(uint8_t *readbuff, uint32_t ReadAddr, uint16_t BlockSize, uint32_t NumberOfBlocks)
 {
   SD_Error errorstatus = SD_OK;
+#if defined (SD_POLLING_MODE)
+  SD_Error stopstatus = SD_OK;
+  uint32_t count = 0, *tempbuff = (uint32_t *)readbuff;
+#endif
   TransferError = SD_OK;
   TransferEnd = 0;
   StopCondition = 1;
@@ -1346,9 +1425,64 @@ SD_Error SD_ReadMultiBlocks(uint8_t *readbuff, uint32_t ReadAddr, uint16_t Block
     return(errorstatus);
   }
 
+#if defined (SD_POLLING_MODE)
+  /*!< Polling mode: unlike the single block case we wait for DATAEND, which
+       is raised once all the blocks have been received, not for DBCKEND */
+  while (!(SDIO->STA &(SDIO_FLAG_RXOVERR | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT | SDIO_FLAG_DATAEND | SDIO_FLAG_STBITERR)))
+  {
+    if (SDIO_GetFlagStatus(SDIO_FLAG_RXFIFOHF) != RESET)
+    {
+      for (count = 0; count < 8; count++)
+      {
+        *(tempbuff + count) = SDIO_ReadData();
+      }
+      tempbuff += 8;
+    }
+  }
+
+  /*!< The card keeps sending blocks until CMD12 is received, so the transfer
+       has to be stopped whether it ended correctly or not */
+  stopstatus = SD_StopTransfer();
+  StopCondition = 0;
+
+  if (SDIO_GetFlagStatus(SDIO_FLAG_DTIMEOUT) != RESET)
+  {
+    errorstatus = SD_DATA_TIMEOUT;
+  }
+  else if (SDIO_GetFlagStatus(SDIO_FLAG_DCRCFAIL) != RESET)
+  {
+    errorstatus = SD_DATA_CRC_FAIL;
+  }
+  else if (SDIO_GetFlagStatus(SDIO_FLAG_RXOVERR) != RESET)
+  {
+    errorstatus = SD_RX_OVERRUN;
+  }
+  else if (SDIO_GetFlagStatus(SDIO_FLAG_STBITERR) != RESET)
+  {
+    errorstatus = SD_START_BIT_ERR;
+  }
+  else
+  {
+    count = SD_DATATIMEOUT;
+    while ((SDIO_GetFlagStatus(SDIO_FLAG_RXDAVL) != RESET) && (count > 0))
+    {
+      *tempbuff = SDIO_ReadData();
+      tempbuff++;
+      count--;
+    }
+    errorstatus = stopstatus;
+  }
+
+  /*!< Clear all the static flags */
+  SDIO_ClearFlag(SDIO_STATIC_FLAGS);
+
+#elif defined (SD_DMA_MODE)
+  DMAEndOfTransfer = 0;
+  TransferPending = 1;
   SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND | SDIO_IT_RXOVERR | SDIO_IT_STBITERR, ENABLE);
   SDIO_DMACmd(ENABLE);
   SD_LowLevel_DMA_RxConfig((uint32_t *)readbuff, (NumberOfBlocks * BlockSize));
+#endif
 
   return(errorstatus);
 }
@@ -1363,46 +1497,11 @@ SD_Error SD_ReadMultiBlocks(uint8_t *readbuff, uint32_t ReadAddr, uint16_t Block
   */
 SD_Error SD_WaitReadOperation(void)
 {
-  SD_Error errorstatus = SD_OK;
-  uint32_t timeout;
-
-  timeout = SD_DATATIMEOUT;
-  
-  while ((DMAEndOfTransfer == 0x00) && (TransferEnd == 0) && (TransferError == SD_OK) && (timeout > 0))
-  {
-    timeout--;
-  }
-  
-  DMAEndOfTransfer = 0x00;
-
-  timeout = SD_DATATIMEOUT;
-  
-  while(((SDIO->STA & SDIO_FLAG_RXACT)) && (timeout > 0))
-  {
-    timeout--;  
-  }
-
-  if (StopCondition == 1)
-  {
-    errorstatus = SD_StopTransfer();
-  }
-  
-  if ((timeout == 0) && (errorstatus == SD_OK))
-  {
-    errorstatus = SD_DATA_TIMEOUT;
-  }
-  
-  /*!< Clear all the static flags */
-  SDIO_ClearFlag(SDIO_STATIC_FLAGS);
-
-  if (TransferError != SD_OK)
-  {
-    return(TransferError);
-  }
-  else
-  {
-    return(errorstatus);  
-  }
+#if defined (SD_DMA_MODE)
+  return(WaitTransfer());
+#else
+  return(SD_OK);
+#endif
 }
 
 /**
@@ -1529,6 +1628,8 @@ SD_Error SD_WriteBlock(uint8_t *writebuff, uint32_t WriteAddr, uint16_t BlockSiz
     return(errorstatus);
   }
 #elif defined (SD_DMA_MODE)
+  DMAEndOfTransfer = 0;
+  TransferPending = 1;
   SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND | SDIO_IT_RXOVERR | SDIO_IT_STBITERR, ENABLE);
   SD_LowLevel_DMA_TxConfig((uint32_t *)writebuff, BlockSize);
   SDIO_DMACmd(ENABLE);
@@ -1637,6 +1738,8 @@ SD_Error SD_WriteMultiBlocks(uint8_t *writebuff, uint32_t WriteAddr, uint16_t Bl
   SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
   SDIO_DataConfig(&SDIO_DataInitStructure);
 
+  DMAEndOfTransfer = 0;
+  TransferPending = 1;
   SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND | SDIO_IT_RXOVERR | SDIO_IT_STBITERR, ENABLE);
   SDIO_DMACmd(ENABLE);
   SD_LowLevel_DMA_TxConfig((uint32_t *)writebuff, (NumberOfBlocks * BlockSize));
@@ -1654,46 +1757,33 @@ SD_Error SD_WriteMultiBlocks(uint8_t *writebuff, uint32_t WriteAddr, uint16_t Bl
   */
 SD_Error SD_WaitWriteOperation(void)
 {
-  SD_Error errorstatus = SD_OK;
-  uint32_t timeout;
-
-  timeout = SD_DATATIMEOUT;
-  
-  while ((DMAEndOfTransfer == 0x00) && (TransferEnd == 0) && (TransferError == SD_OK) && (timeout > 0))
-  {
-    timeout--;
-  }
-  
-  DMAEndOfTransfer = 0x00;
+#if defined (SD_DMA_MODE)
+  return(WaitTransfer());
+#else
+  return(SD_OK);
+#endif
+}
 
-  timeout = SD_DATATIMEOUT;
-  
-  while(((SDIO->STA & SDIO_FLAG_TXACT)) && (timeout > 0))
-  {
-    timeout--;  
-  }
+/**
+  * @brief  Sets the function to be called from interrupt context when a DMA
+  *         transfer finishes. This allows to start a transfer and do other work
+  *         meanwhile instead of waiting in SD_WaitReadOperation().
+  * @param  callback: function to call, or 0 to disable the notification.
+  * @retval None
+  */
+void SD_SetTransferCallback(SD_TransferCallback callback)
+{
+  TransferCallback = callback;
+}
 
-  if (StopCondition == 1)
-  {
-    errorstatus = SD_StopTransfer();
-  }
-  
-  if ((timeout == 0) && (errorstatus == SD_OK))
-  {
-    errorstatus = SD_DATA_TIMEOUT;
-  }
-  
-  /*!< Clear all the static flags */
-  SDIO_ClearFlag(SDIO_STATIC_FLAGS);
-  
-  if (TransferError != SD_OK)
-  {
-    return(TransferError);
-  }
-  else
-  {
-    return(errorstatus);
-  }
+/**
+  * @brief  Tells if a DMA transfer has been started and has not finished yet.
+  * @param  None
+  * @retval 1 if the transfer is still going on, 0 otherwise.
+  */
+uint8_t SD_IsTransferPending(void)
+{
+  return(TransferPending != 0);
 }
 
 uint32_t SD_GetSectorSize() {
@@ -2039,6 +2129,10 @@ SD_Error SD_ProcessIRQSrc(void)
   SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND |
                 SDIO_IT_TXFIFOHE | SDIO_IT_RXFIFOHF | SDIO_IT_TXUNDERR |
                 SDIO_IT_RXOVERR | SDIO_IT_STBITERR, DISABLE);
+
+#if defined (SD_DMA_MODE)
+  CompleteTransfer();
+#endif
   return(TransferError);
 }
 
@@ -2054,8 +2148,128 @@ void SD_ProcessDMAIRQ(void)
     DMAEndOfTransfer = 0x01;
     DMA_ClearFlag(SD_SDIO_DMA_STREAM, SD_SDIO_DMA_FLAG_TCIF|SD_SDIO_DMA_FLAG_FEIF);
   }
+
+#if defined (SD_DMA_MODE)
+  CompleteTransfer();
+#endif
+}
+
+#if defined (SD_DMA_MODE)
+/**
+  * @brief  Enables the SDIO and SDIO DMA stream interrupts in the NVIC.
+  * @param  None
+  * @retval None
+  */
+static void NVIC_Configuration(void)
+{
+  NVIC_InitTypeDef NVIC_InitStructure;
+
+  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
+
+  NVIC_InitStructure.NVIC_IRQChannel = SDIO_IRQn;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = SD_IRQ_PREEMPTION_PRIORITY;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = SD_SDIO_IRQ_SUBPRIORITY;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+
+  NVIC_InitStructure.NVIC_IRQChannel = SD_SDIO_DMA_IRQn;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = SD_DMA_IRQ_SUBPRIORITY;
+  NVIC_Init(&NVIC_InitStructure);
 }
 
+/**
+  * @brief  Finishes the current DMA transfer once both the SDIO (DATAEND) and
+  *         the DMA (transfer complete) sides are done, or as soon as the SDIO
+  *         reports an error. Multiple block transfers are stopped here with
+  *         CMD12 and then the transfer callback, if any, is called. It runs
+  *         from both interrupt handlers, which have the same preemption
+  *         priority, so it can't be reentered.
+  * @param  None
+  * @retval None
+  */
+static void CompleteTransfer(void)
+{
+  SD_Error status = TransferError;
+  SD_Error stopstatus;
+
+  if (!TransferPending)
+  {
+    return;
+  }
+  if ((status == SD_OK) && !(TransferEnd && DMAEndOfTransfer))
+  {
+    return;
+  }
+
+  if (status != SD_OK)
+  {
+    DMA_Cmd(SD_SDIO_DMA_STREAM, DISABLE);
+  }
+  SDIO_DMACmd(DISABLE);
+
+  if (StopCondition == 1)
+  {
+    StopCondition = 0;
+    stopstatus = SD_StopTransfer();
+    if (status == SD_OK)
+    {
+      status = stopstatus;
+    }
+  }
+
+  /*!< Clear all the static flags */
+  SDIO_ClearFlag(SDIO_STATIC_FLAGS);
+
+  TransferStatus = status;
+  TransferPending = 0;
+
+  if (TransferCallback != 0)
+  {
+    TransferCallback(status);
+  }
+}
+
+/**
+  * @brief  Waits until the interrupt handlers have finished the current DMA
+  *         transfer. If they never do the transfer is aborted, and the
+  *         transfer callback, if any, is told so like CompleteTransfer() does.
+  * @param  None
+  * @retval SD_Error: SD Card Error code.
+  */
+static SD_Error WaitTransfer(void)
+{
+  uint32_t timeout = SD_DATATIMEOUT;
+
+  while (TransferPending && (timeout > 0))
+  {
+    timeout--;
+  }
+
+  if (TransferPending)
+  {
+    SDIO_ITConfig(SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND |
+                  SDIO_IT_TXUNDERR | SDIO_IT_RXOVERR | SDIO_IT_STBITERR, DISABLE);
+    DMA_Cmd(SD_SDIO_DMA_STREAM, DISABLE);
+    SDIO_DMACmd(DISABLE);
+    if (StopCondition == 1)
+    {
+      StopCondition = 0;
+      SD_StopTransfer();
+    }
+    SDIO_ClearFlag(SDIO_STATIC_FLAGS);
+    TransferStatus = SD_DATA_TIMEOUT;
+    TransferPending = 0;
+    if (TransferCallback != 0)
+    {
+      TransferCallback(SD_DATA_TIMEOUT);
+    }
+    return(SD_DATA_TIMEOUT);
+  }
+
+  return(TransferStatus);
+}
+#endif
+
 /**
   * @brief  Checks for error conditions for CMD0.
   * @param  None
@@ -2675,6 +2889,248 @@ static SD_Error IsCardProgramming(uint8_t *pstatus)
   return(errorstatus);
 }
 
+/**
+  * @brief  Configures the clock and the data bus width of the SDIO peripheral.
+  * @param  ClockDiv: SDIO_CK = SDIOCLK / (ClockDiv + 2), unless bypassed.
+  * @param  ClockBypass: SDIO_ClockBypass_Enable to use SDIOCLK (48MHz) directly.
+  * @param  BusWide: SDIO_BusWide_1b or SDIO_BusWide_4b.
+  * @retval None
+  */
+static void SDConfigureBus(uint8_t ClockDiv, uint32_t ClockBypass, uint32_t BusWide)
+{
+  SDIO_InitStructure.SDIO_ClockDiv = ClockDiv;
+  SDIO_InitStructure.SDIO_ClockEdge = SDIO_ClockEdge_Rising;
+  SDIO_InitStructure.SDIO_ClockBypass = ClockBypass;
+  SDIO_InitStructure.SDIO_ClockPowerSave = SDIO_ClockPowerSave_Disable;
+  SDIO_InitStructure.SDIO_BusWide = BusWide;
+  SDIO_InitStructure.SDIO_HardwareFlowControl = SDIO_HardwareFlowControl_Disable;
+  SDIO_Init(&SDIO_InitStructure);
+}
+
+/**
+  * @brief  Sends CMD6 (SWITCH_FUNC) and reads the 64 bytes switch status
+  *         that the card returns on the data lines.
+  * @param  argument: CMD6 argument (mode bit and the function of every group).
+  * @param  pstatus: pointer to a 64 bytes buffer, aligned to 4 bytes, that
+  *         receives the switch status with its most significant byte first.
+  * @retval SD_Error: SD Card Error code.
+  */
+static SD_Error SDSwitchFunction(uint32_t argument, uint8_t *pstatus)
+{
+  SD_Error errorstatus = SD_OK;
+  uint32_t *tempbuff = (uint32_t *)pstatus;
+  uint32_t count = 0;
+
+  /*!< Set Block Size To 64 Bytes */
+  SDIO_CmdInitStructure.SDIO_Argument = 64;
+  SDIO_CmdInitStructure.SDIO_CmdIndex = SD_CMD_SET_BLOCKLEN;
+  SDIO_CmdInitStructure.SDIO_Response = SDIO_Response_Short;
+  SDIO_CmdInitStructure.SDIO_Wait = SDIO_Wait_No;
+  SDIO_CmdInitStructure.SDIO_CPSM = SDIO_CPSM_Enable;
+  SDIO_SendCommand(&SDIO_CmdInitStructure);
+
+  errorstatus = CmdResp1Error(SD_CMD_SET_BLOCKLEN);
+
+  if (errorstatus != SD_OK)
+  {
+    return(errorstatus);
+  }
+
+  SDIO_DataInitStructure.SDIO_DataTimeOut = SD_DATATIMEOUT;
+  SDIO_DataInitStructure.SDIO_DataLength = 64;
+  SDIO_DataInitStructure.SDIO_DataBlockSize = SDIO_DataBlockSize_64b;
+  SDIO_DataInitStructure.SDIO_TransferDir = SDIO_TransferDir_ToSDIO;
+  SDIO_DataInitStructure.SDIO_TransferMode = SDIO_TransferMode_Block;
+  SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
+  SDIO_DataConfig(&SDIO_DataInitStructure);
+
+  /*!< Send CMD6 SWITCH_FUNC */
+  SDIO_CmdInitStructure.SDIO_Argument = argument;
+  SDIO_CmdInitStructure.SDIO_CmdIndex = SD_CMD_HS_SWITCH;
+  SDIO_CmdInitStructure.SDIO_Response = SDIO_Response_Short;
+  SDIO_CmdInitStructure.SDIO_Wait = SDIO_Wait_No;
+  SDIO_CmdInitStructure.SDIO_CPSM = SDIO_CPSM_Enable;
+  SDIO_SendCommand(&SDIO_CmdInitStructure);
+
+  errorstatus = CmdResp1Error(SD_CMD_HS_SWITCH);
+
+  if (errorstatus != SD_OK)
+  {
+    return(errorstatus);
+  }
+
+  while (!(SDIO->STA & (SDIO_FLAG_RXOVERR | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT | SDIO_FLAG_DBCKEND | SDIO_FLAG_STBITERR)))
+  {
+    if (SDIO_GetFlagStatus(SDIO_FLAG_RXFIFOHF) != RESET)
+    {
+      for (count = 0; count < 8; count++)
+      {
+        *(tempbuff + count) = SDIO_ReadData();
+      }
+      tempbuff += 8;
+    }
+  }
+
+  if (SDIO_GetFlagStatus(SDIO_FLAG_DTIMEOUT) != RESET)
+  {
+    SDIO_ClearFlag(SDIO_FLAG_DTIMEOUT);
+    errorstatus = SD_DATA_TIMEOUT;
+    return(errorstatus);
+  }
+  else if (SDIO_GetFlagStatus(SDIO_FLAG_DCRCFAIL) != RESET)
+  {
+    SDIO_ClearFlag(SDIO_FLAG_DCRCFAIL);
+    errorstatus = SD_DATA_CRC_FAIL;
+    return(errorstatus);
+  }
+  else if (SDIO_GetFlagStatus(SDIO_FLAG_RXOVERR) != RESET)
+  {
+    SDIO_ClearFlag(SDIO_FLAG_RXOVERR);
+    errorstatus = SD_RX_OVERRUN;
+    return(errorstatus);
+  }
+  else if (SDIO_GetFlagStatus(SDIO_FLAG_STBITERR) != RESET)
+  {
+    SDIO_ClearFlag(SDIO_FLAG_STBITERR);
+    errorstatus = SD_START_BIT_ERR;
+    return(errorstatus);
+  }
+
+  count = SD_DATATIMEOUT;
+  while ((SDIO_GetFlagStatus(SDIO_FLAG_RXDAVL) != RESET) && (count > 0))
+  {
+    *tempbuff = SDIO_ReadData();
+    tempbuff++;
+    count--;
+  }
+
+  /*!< Clear all the static flags */
+  SDIO_ClearFlag(SDIO_STATIC_FLAGS);
+
+  return(errorstatus);
+}
+
+/**
+  * @brief  Switches the card to High Speed mode (up to 50MHz) with CMD6, if
+  *         it supports it. The SDIO clock itself is not changed.
+  * @param  None
+  * @retval SD_Error: SD_OK if the card is now in High Speed mode,
+  *         SD_UNSUPPORTED_FEATURE if it refused, or the error of the transfer.
+  */
+static SD_Error SDEnHighSpeed(void)
+{
+  SD_Error errorstatus = SD_OK;
+  uint32_t scr[2] = {0, 0};
+  uint32_t switchstatus[16];
+  uint8_t *pstatus = (uint8_t *)switchstatus;
+
+  errorstatus = FindSCR(RCA, scr);
+
+  if (errorstatus != SD_OK)
+  {
+    return(errorstatus);
+  }
+
+  /*!< CMD6 is only supported from the version 1.10 of the specification on */
+  if (((scr[1] >> 24) & 0x0F) == 0)
+  {
+    return(SD_UNSUPPORTED_FEATURE);
+  }
+
+  /*!< Check mode: is function 1 (High Speed) of group 1 supported? (bit 401) */
+  errorstatus = SDSwitchFunction(SD_SWITCH_CHECK_HIGH_SPEED, pstatus);
+
+  if (errorstatus != SD_OK)
+  {
+    return(errorstatus);
+  }
+
+  if (!(pstatus[13] & 0x02))
+  {
+    return(SD_UNSUPPORTED_FEATURE);
+  }
+
+  /*!< Switch mode: the function selected for group 1 is in bits 379:376 */
+  errorstatus = SDSwitchFunction(SD_SWITCH_SET_HIGH_SPEED, pstatus);
+
+  if (errorstatus != SD_OK)
+  {
+    return(errorstatus);
+  }
+
+  if ((pstatus[16] & 0x0F) != 0x01)
+  {
+    return(SD_UNSUPPORTED_FEATURE);
+  }
+
+  return(errorstatus);
+}
+
+/**
+  * @brief  Negotiates the fastest bus the card accepts: first the 4-bit bus
+  *         and then High Speed mode. Every step is verified by reading the SD
+  *         Status register through the new settings, which must also report
+  *         the width that was asked for, and undone if that read fails, so a
+  *         card that refuses any of them is still used with the settings that
+  *         worked.
+  * @param  None
+  * @retval SD_Error: SD Card Error code, only if not even the 1-bit bus at the
+  *         default speed works.
+  */
+static SD_Error SDNegotiateBus(void)
+{
+  SD_Error errorstatus = SD_OK;
+  SD_CardStatus cardstatus;
+
+  BusInfo.BusWidth = 1;
+  BusInfo.HighSpeed = 0;
+  BusInfo.ClockKHz = SD_SDIOCLK_KHZ / (SDIO_TRANSFER_CLK_DIV + 2);
+
+  /*!< MMC cards have neither the SD Status register nor CMD6 High Speed */
+  if (SDIO_MULTIMEDIA_CARD == CardType)
+  {
+    return(SD_OK);
+  }
+
+  if ((SD_EnableWideBusOperation(SDIO_BusWide_4b) == SD_OK)
+      && (SD_GetCardStatus(&cardstatus) == SD_OK)
+      && (cardstatus.DAT_BUS_WIDTH == SD_STATUS_BUS_WIDTH_4B))
+  {
+    BusInfo.BusWidth = 4;
+  }
+  else
+  {
+    /*!< Tell the card to go back to 1 bit, if it switched, and the SDIO too */
+    SD_EnableWideBusOperation(SDIO_BusWide_1b);
+    SDConfigureBus(SDIO_TRANSFER_CLK_DIV, SDIO_ClockBypass_Disable, SDIO_BusWide_1b);
+
+    errorstatus = SD_GetCardStatus(&cardstatus);
+
+    if (errorstatus != SD_OK)
+    {
+      return(errorstatus);
+    }
+  }
+
+  if (SDEnHighSpeed() == SD_OK)
+  {
+    SDConfigureBus(0, SDIO_ClockBypass_Enable, SDIO_InitStructure.SDIO_BusWide);
+
+    if (SD_GetCardStatus(&cardstatus) == SD_OK)
+    {
+      BusInfo.HighSpeed = 1;
+      BusInfo.ClockKHz = SD_SDIOCLK_KHZ;
+    }
+    else
+    {
+      /*!< A card in High Speed mode also works at the default clock */
+      SDConfigureBus(SDIO_TRANSFER_CLK_DIV, SDIO_ClockBypass_Disable, SDIO_InitStructure.SDIO_BusWide);
+    }
+  }
+
+  return(SD_OK);
+}
+
 /**
   * @brief  Find the SD card SCR register value.
   * @param  rca: selected card address.
@@ -223,6 +223,23 @@ typedef struct
   uint8_t CardType;
 } SD_CardInfo;
 
+/** 
+  * @brief  Bus settings negotiated with the card by SD_Init()
+  */
+typedef struct
+{
+  uint8_t BusWidth;       /*!< Data bus width: 1 or 4 bits */
+  uint8_t HighSpeed;      /*!< 1 if the card was switched to High Speed mode */
+  uint32_t ClockKHz;      /*!< SDIO_CK frequency in kHz */
+} SD_BusInfo;
+
+/** 
+  * @brief  Function called from interrupt context when a DMA transfer started
+  *         by SD_ReadBlock(), SD_ReadMultiBlocks(), SD_WriteBlock() or
+  *         SD_WriteMultiBlocks() has finished, with its final status.
+  */
+typedef void (*SD_TransferCallback)(SD_Error status);
+
 /**
   * @}
   */
@@ -312,10 +329,19 @@ typedef struct
   
 /* Uncomment the following line to select the SDIO Data transfer mode */  
 #if !defined (SD_DMA_MODE) && !defined (SD_POLLING_MODE)
-//#define SD_DMA_MODE                                ((uint32_t)0x00000000)
-#define SD_POLLING_MODE                            ((uint32_t)0x00000002)
+#define SD_DMA_MODE                                ((uint32_t)0x00000000)
+//#define SD_POLLING_MODE                            ((uint32_t)0x00000002)
 #endif
 
+/** 
+  * @brief  Interrupt priorities used in DMA mode (NVIC_PriorityGroup_2). Both
+  *         interrupts share the preemption priority so that they never
+  *         interrupt each other while completing a transfer.
+  */
+#define SD_IRQ_PREEMPTION_PRIORITY                 ((uint8_t)0x01)
+#define SD_SDIO_IRQ_SUBPRIORITY                    ((uint8_t)0x00)
+#define SD_DMA_IRQ_SUBPRIORITY                     ((uint8_t)0x01)
+
 /**
   * @brief  SD detection on its memory slot
   */
@@ -373,6 +399,10 @@ SD_Error SD_ProcessIRQSrc(void);
 void SD_ProcessDMAIRQ(void);
 SD_Error SD_WaitReadOperation(void);
 SD_Error SD_WaitWriteOperation(void);
+void SD_SetTransferCallback(SD_TransferCallback callback);
+uint8_t SD_IsTransferPending(void);
+void SD_GetBusInfo(SD_BusInfo *businfo);
+SD_Error SD_DecreaseBusClock(void);
 uint32_t SD_GetSectorSize();
 #ifdef __cplusplus
 }
@@ -24,6 +24,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_it.h"
 #include "stm324xg_eval_sdio_sd.h"
+#include "player.h"
 
 /** @addtogroup STM32F4xx_StdPeriph_Examples
   * @{
@@ -163,6 +164,30 @@ void SD_SDIO_DMA_IRQHANDLER(void)
   SD_ProcessDMAIRQ();
 }
 
+/**
+  * @brief  This function handles EXTI lines 5 to 9 interrupt requests, line 9
+  *         is the VS1053 DREQ.
+  * @param  None
+  * @retval None
+  */
+void EXTI9_5_IRQHandler(void)
+{
+  /* Feed the VS1053 if it asks for data */
+  SdiProcessDreqIRQ();
+}
+
+/**
+  * @brief  This function handles DMA1 Stream4 global interrupt request, the
+  *         end of an SDI burst to the VS1053.
+  * @param  None
+  * @retval None
+  */
+void DMA1_Stream4_IRQHandler(void)
+{
+  /* End the burst and start the next one */
+  SdiProcessDMAIRQ();
+}
+
 /******************************************************************************/
 /*                 STM32F4xx Peripherals Interrupt Handlers                   */
 /*  Add here the Interrupt Handler for the used peripheral(s) (PPP), for the  */
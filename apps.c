@@ -25,7 +25,12 @@
  */
 
 #include <apps.h>
+#include <catalog.h>
 #include <lcd.h>
+#include <listing.h>
+#include <names.h>
+#include <navigation.h>
+#include <tags.h>
 #include <touch.h>
 #include <utils.h>
 
@@ -436,6 +441,184 @@ uint8_t txt_viewer() {
 	else return 1;
 }
 
+/*
+ * DIRECTORY CHECKPOINTS: the file manager used to read the whole directory
+ * on every arrow press, first to reach the current position and then to count
+ * the remaining files for the scroll bar. Now we remember where every
+ * interval-th entry of the current directory lies by keeping a copy of the
+ * DIR object taken right before that entry was read. Scrolling restores the
+ * nearest checkpoint and reads at most one interval plus 10 entries, and the
+ * total count is remembered once the directory was read to its end. Only the
+ * directory currently on screen is tracked, going to another one simply
+ * starts over.
+ */
+static struct Dir_checkpoints checkpoints;
+
+/*
+ * Makes the checkpoint table describe the directory that was just opened. If
+ * it describes another directory or another mount of the card, it's cleared.
+ */
+static void checkpoint_select(DIR* directory) {
+	if (checkpoints.count && checkpoints.id == directory->id &&
+			checkpoints.sclust == directory->sclust) return;
+	checkpoints.id = directory->id;
+	checkpoints.sclust = directory->sclust;
+	checkpoints.total = 0xFFFF;
+	checkpoints.interval = DIR_CHECKPOINT_INTERVAL;
+	checkpoints.count = 0;
+}
+
+/*
+ * Must be called right before the entry number "entry" is read from the
+ * directory. Saves the position if it's the next checkpoint we don't have yet.
+ * When the table is full every second checkpoint is dropped and the interval
+ * is doubled.
+ */
+static void checkpoint_record(DIR* directory, uint16_t entry) {
+	if (entry % checkpoints.interval) return;
+	if (checkpoints.count == DIR_CHECKPOINTS &&
+			entry == DIR_CHECKPOINTS * checkpoints.interval) {
+		uint8_t i;
+		for (i = 1; i < DIR_CHECKPOINTS/2; ++i) {
+			checkpoints.points[i] = checkpoints.points[2*i];
+		}
+		checkpoints.count = DIR_CHECKPOINTS/2;
+		checkpoints.interval *= 2;
+	}
+	if (entry == checkpoints.count * checkpoints.interval &&
+			checkpoints.count < DIR_CHECKPOINTS) {
+		checkpoints.points[checkpoints.count++] = *directory;
+	}
+}
+
+/*
+ * Moves the directory to the closest checkpoint at or before "entry" and
+ * returns the number of the entry that will be read next. If there are no
+ * checkpoints yet, the directory is left untouched and 0 is returned.
+ */
+static uint16_t checkpoint_restore(DIR* directory, uint16_t entry) {
+	uint16_t k;
+	if (!checkpoints.count) return 0;
+	k = entry/checkpoints.interval;
+	if (k >= checkpoints.count) k = checkpoints.count - 1;
+	*directory = checkpoints.points[k];
+	return k*checkpoints.interval;
+}
+
+/*
+ * Writes the duration of a file as minutes and seconds, aligned to the right
+ * of the row.
+ */
+static void show_duration(uint16_t seconds, uint16_t y) {
+	char text[6];
+	uint8_t length = 0;
+	uint16_t minutes = seconds / 60;
+	uint16_t width = 0;
+	uint8_t i;
+
+	if (minutes > 99) minutes = 99;
+	if (minutes > 9) text[length++] = '0' + minutes / 10;
+	text[length++] = '0' + minutes % 10;
+	text[length++] = ':';
+	itoa_time_segment(seconds % 60, text + length);
+	length += 2;
+	for (i = 0; i < length; ++i) width += get_letter_length(text[i]) + 1;
+	write_phrase_limitedLCD(text, length, 456 - width, y, 455, 0x0000, 0xFFFF);
+}
+
+/*
+ * Writes a row of the file manager's menu: the name of the entry and if it's
+ * a file or a directory. The rest of a longer name that was shown before in
+ * that row is cleared.
+ *
+ * An audio file whose tags were read (see tags.c) shows its title and artist
+ * instead of its name and its duration instead of "file". If they were not
+ * read yet, the row is marked so the file manager reads them later, the
+ * directory starting at cluster "directory" is the one being shown.
+ */
+static void show_entry(struct Menu_object* entry, uint16_t* previous_lenght,
+		uint16_t y, DWORD directory) {
+	const struct Tags* tags = 0;
+	uint16_t lenght;
+
+	entry->tags_pending = 0;
+	if (entry->fattrib != AM_DIR && is_it_audio(entry->fname)) {
+		tags = tags_find(directory, entry->fname);
+		entry->tags_pending = !tags;
+	}
+
+	if (tags && tags->title[0]) {
+		lenght = write_phrase_limitedLCD((char*)tags->title, TAGS_TEXT_LENGTH,
+				0, y, 405, 0x0000, 0xFFFF);
+		if (tags->artist[0]) {
+			lenght = write_phrase_limitedLCD(" - ", 3, lenght + 1, y, 405,
+					0x0000, 0xFFFF);
+			lenght = write_phrase_limitedLCD((char*)tags->artist,
+					TAGS_TEXT_LENGTH, lenght + 1, y, 405, 0x0000, 0xFFFF);
+		}
+	}
+	else if (entry->long_name) {
+		lenght = write_phrase_limitedLCD((char*)entry->long_name, _MAX_LFN, 0,
+				y, 405, 0x0000, 0xFFFF);
+	}
+	else {
+		lenght = write_phraseLCD(entry->fname, 13, 0, y, 0x0000, 0xFFFF);
+	}
+	if (lenght < *previous_lenght) {
+		paint_areaLCD(lenght + 1, y, *previous_lenght, y + 23, 0xFFFF);
+	}
+	*previous_lenght = lenght;
+	paint_areaLCD(410, y, 455, y + 23, 0xFFFF);
+	if (entry->fattrib == AM_DIR) {
+		write_phraseLCD("dir ", 4, 415, y, 0x0000, 0xFFFF);
+	}
+	else if (tags && tags->seconds) {
+		show_duration(tags->seconds, y);
+	}
+	else {
+		write_phraseLCD("file", 4, 415, y, 0x0000, 0xFFFF);
+	}
+	entry->exists = 1;
+}
+
+/*
+ * Keys of the letter strip, row after row. The space is shown as '_' and '<'
+ * removes the last character of the filter.
+ */
+static const char filter_keys[2*FILTER_STRIP_COLUMNS] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ_<";
+
+/*
+ * Draws the letter strip of the filter, or clears its place if it's hidden.
+ * The "Find" button that shows it is drawn pressed while it's shown.
+ */
+static void show_filter_strip(uint8_t shown) {
+	uint8_t i;
+	if (!shown) {
+		paint_areaLCD(0, FILTER_STRIP_Y, 455, 271, 0xFFFF);
+		paint_areaLCD(210, 0, 415, 31, 0xFFFF);
+		write_phraseLCD("Find", 4, 420, 0, 0x0000, 0xFFFF);
+		return;
+	}
+	write_phraseLCD("Find", 4, 420, 0, 0xFFFF, 0x0000);
+	paint_areaLCD(0, FILTER_STRIP_Y, 455, 271, 0xC618);
+	for (i = 0; i < 2*FILTER_STRIP_COLUMNS; ++i) {
+		write_letterLCD(filter_keys[i], (i % FILTER_STRIP_COLUMNS)*32 + 10,
+				FILTER_STRIP_Y + (i / FILTER_STRIP_COLUMNS)*24, 0x0000, 0xC618);
+	}
+}
+
+/*
+ * Writes the filter typed so far next to the name of the directory.
+ */
+static void show_filter_text() {
+	char text[LISTING_FILTER_LENGTH + 1];
+	uint8_t length = listing_filter_length();
+	mem_cpy(text, (char*)listing_filter_text(), length);
+	text[length] = '_';
+	paint_areaLCD(210, 0, 415, 31, 0xFFFF);
+	write_phrase_limitedLCD(text, length + 1, 210, 0, 415, 0x0000, 0xFFFF);
+}
+
 /*
  * This function acts like a file manager program. It manages both the file
  * managing mechanics and interface, so there is no formal separation between
@@ -443,10 +626,21 @@ uint8_t txt_viewer() {
  * straightforward: we a have a "current" position that indicates the first
  * file to be displayed on screen. In total, we'll display 10 files or
  * directories on screen. The user can go up and down, and each time he/she
- * issues a command, the file manager will have to read the whole directory,
- * because we don't save anywhere contents of directory. This is by far not the
- * best approach, but it is efficient enough given that we want to save as much
- * RAM as we can.
+ * issues a command, the file manager reopens the directory and reads it from
+ * the closest checkpoint, because we don't save anywhere contents of
+ * directory. The checkpoints cost a fixed amount of RAM and make scrolling
+ * equally fast at the top and at the bottom of a big directory.
+ *
+ * The "Find" button shows a strip of letters in place of the last 2 rows.
+ * Typing on it filters the sorted directory by the beginning of the names
+ * (see listing.c), each letter narrowing what the previous ones matched.
+ * The filtered entries are scrolled with their own cursor, so removing the
+ * filter goes back to where the user was in the whole directory.
+ *
+ * The track of the scroll bar is also a rail of the letters from A, at the
+ * top, to Z, at the bottom. Once the directory is sorted, touching it jumps
+ * to the first file that begins with that letter, which listing.c already
+ * knows, so nothing is read but the entries shown.
  */
 uint8_t file_manager() {
 	struct Box arrow_up;
@@ -467,6 +661,31 @@ uint8_t file_manager() {
 	folder_up.x_end = 23;
 	folder_up.y_end = 23;
 
+	struct Box letter_rail;
+	letter_rail.x_start = 456;
+	letter_rail.y_start = 57;
+	letter_rail.x_end = 479;
+	letter_rail.y_end = 247;
+
+	struct Box find_button;
+	find_button.x_start = 416;
+	find_button.y_start = 0;
+	find_button.x_end = 479;
+	find_button.y_end = 31;
+
+	//The "dir" labels of the rows, touching one plays the directory's tree.
+	struct Box tree_labels;
+	tree_labels.x_start = 410;
+	tree_labels.y_start = 32;
+	tree_labels.x_end = 455;
+	tree_labels.y_end = 271;
+
+	struct Box filter_strip;
+	filter_strip.x_start = 0;
+	filter_strip.y_start = FILTER_STRIP_Y;
+	filter_strip.x_end = 32*FILTER_STRIP_COLUMNS - 1;
+	filter_strip.y_end = 271;
+
 	struct Menu_area files_menu;
 	files_menu.x_start = 0;
 	files_menu.y_start = 32;
@@ -489,13 +708,22 @@ uint8_t file_manager() {
 	uint8_t folder_up_button_pressed = 0;
 	uint8_t arrow_up_button_pressed = 0;
 	uint8_t arrow_down_button_pressed = 0;
-	char* s_file = "file";
-	char* s_dir = "dir ";
+	uint8_t strip_shown = 0;
+	uint8_t rows = 10;
+	uint16_t filter_cursor = 0;
+	struct Navigation_level* level = navigation_current();
+	uint16_t* cursor = &level->cursor;
+
+	for (current_file = 0; current_file < 10; ++current_file)
+		file_list[current_file].exists = 0;
 
-	write_phraseLCD(&visited_directories[depth][0], 13, 29, 0, 0x0000, 0xFFFF);
+	write_phrase_limitedLCD(level->name, level->name_length, 29, 0, 200,
+			0x0000, 0xFFFF);
 	paint_imageLCD((uint16_t*)folder_up_image, folder_up.x_start, folder_up.y_start);
 	paint_imageLCD((uint16_t*)arrow_up_image, arrow_up.x_start, arrow_up.y_start);
 	paint_imageLCD((uint16_t*)arrow_down_image, arrow_down.x_start, arrow_down.y_start);
+	listing_filter_clear();
+	show_filter_strip(0);
 
 	reset_touch_fifo();
 
@@ -518,12 +746,25 @@ uint8_t file_manager() {
 		 */
 		if (new_order == 1) {
 			DIR directory;
-			FRESULT result = f_opendir(&directory, current_directory_path);
+			FRESULT result;
+			listing_open(current_directory_path);
+			names_reset_shown();
+			result = f_opencluster(&directory, level->sclust);
 			if (result == FR_OK) {
 				FILINFO file;
+				names_attach(&file);
 				uint16_t screen_position = 32;
 				total_files = 0;
-				uint8_t proceed = 1;
+				/*
+				 * Once listing.c has sorted the directory, the entries are
+				 * taken from there and the directory itself is not read.
+				 * Until then it's shown in the order it has on the card.
+				 */
+				uint8_t sorted = listing_ready();
+				uint8_t proceed = !sorted;
+				cursor = (sorted && listing_filter_length()) ?
+						&filter_cursor : &level->cursor;
+				if (strip_shown) show_filter_text();
 				/*
 				 * What follows is the code to process the first 2 entries in
 				 * any directory except the root directory - "." and "..". In
@@ -533,7 +774,7 @@ uint8_t file_manager() {
 				 * while trying to read the entries, something went very wrong
 				 * and we should immediately stop.
 				 */
-				if (depth != 0) {
+				if (navigation_depth() != 0 && proceed) {
 					result = f_readdir(&directory, &file);
 					if (file.fname[0] == 0 || result != FR_OK) {
 						proceed = 0;
@@ -547,11 +788,17 @@ uint8_t file_manager() {
 				 * After processing first 2 entries, if that was necessary, we
 				 * should reach the position of the first entry that should be
 				 * displayed on screen, depending on where the user had arrived
-				 * previously. This position is stored in current entry in
-				 * "cursors" array and the current entry is always indicated by
-				 * global "depth" variable.
+				 * previously. This position is stored in the current level of
+				 * the navigation stack (see navigation.c). We jump to the
+				 * closest checkpoint first and only read the entries that
+				 * follow it.
 				 */
-				while (total_files < cursors[depth] && proceed) {
+				checkpoint_select(&directory);
+				if (proceed) {
+					total_files = checkpoint_restore(&directory, level->cursor);
+				}
+				while (total_files < level->cursor && proceed) {
+					checkpoint_record(&directory, total_files);
 					result = f_readdir(&directory, &file);
 					if (file.fname[0] == 0 || result != FR_OK) {
 						proceed = 0;
@@ -565,7 +812,8 @@ uint8_t file_manager() {
 				 * on screen.
 				 */
 				current_file = 0;
-				while (total_files < cursors[depth] + 10 && proceed) {
+				while (total_files < level->cursor + rows && proceed) {
+					checkpoint_record(&directory, total_files);
 					result = f_readdir(&directory, &file);
 					if (file.fname[0] == 0 || result != FR_OK) {
 						proceed = 0;
@@ -573,28 +821,44 @@ uint8_t file_manager() {
 					else {
 						mem_cpy(file_list[current_file].fname, file.fname, 13);
 						file_list[current_file].fattrib = file.fattrib;
-						file_list[current_file].exists = 1;
-						uint16_t lenght = write_phraseLCD(file.fname, 13, 0,
-								screen_position, 0x0000, 0xFFFF);
-						if (lenght < filename_lenght[current_file]) {
-							paint_areaLCD(lenght + 1, screen_position,
-									filename_lenght[current_file],
-									screen_position + 23, 0xFFFF);
-						}
-						filename_lenght[current_file] = lenght;
-						if (file.fattrib == AM_DIR) {
-							write_phraseLCD(s_dir, 4, 415, screen_position,
-									0x0000, 0xFFFF);
-						}
-						else {
-							write_phraseLCD(s_file, 4, 415, screen_position,
-									0x0000, 0xFFFF);
-						}
+						file_list[current_file].long_name =
+								file.lfname[0] ? names_show(file.lfname) : 0;
+						show_entry(&file_list[current_file],
+								&filename_lenght[current_file], screen_position,
+								level->sclust);
 						++current_file;
 						screen_position += 24;
 						++total_files;
 					}
 				}
+				/*
+				 * The sorted listing knows how many entries there are, so the
+				 * cursor is kept inside the directory (the sorted listing
+				 * leaves out system files, so it may have less entries than
+				 * what we counted before) and the visible entries are just
+				 * taken from it, among those that match the filter.
+				 */
+				if (sorted) {
+					struct Listing_record record;
+					total_files = listing_filtered_entries();
+					if (total_files <= rows) *cursor = 0;
+					else if (*cursor > total_files - rows)
+						*cursor = total_files - rows;
+					while (current_file < rows &&
+							*cursor + current_file < total_files &&
+							listing_filtered_get(*cursor + current_file, &record)) {
+						mem_cpy(file_list[current_file].fname, record.name, 12);
+						file_list[current_file].fname[12] = 0;
+						file_list[current_file].fattrib = record.attrib;
+						file_list[current_file].long_name =
+								names_get(record.long_name);
+						show_entry(&file_list[current_file],
+								&filename_lenght[current_file], screen_position,
+								level->sclust);
+						++current_file;
+						screen_position += 24;
+					}
+				}
 				/*
 				 * What follows is proceeding for the case when there are less
 				 * than 10 files in the directory. In that case we will simply
@@ -603,51 +867,63 @@ uint8_t file_manager() {
 				 * there before (for example, if we arrived there from parent
 				 * directory which had 10 or more files). If there are 10 or
 				 * more files in this directory, then this loop will not be
-				 * executed.
+				 * executed. The rows under the letter strip, if it's shown,
+				 * don't exist either.
 				 */
-				while (current_file < 10) {
+				while (current_file < rows) {
 					file_list[current_file].exists = 0;
 					paint_areaLCD(0, screen_position, 239,
 							screen_position + 23, 0xFFFF);
-					paint_areaLCD(415, screen_position, 455,
+					paint_areaLCD(410, screen_position, 455,
 							screen_position + 23, 0xFFFF);
 					screen_position += 24;
 					++current_file;
 				}
+				while (current_file < 10) {
+					file_list[current_file].exists = 0;
+					filename_lenght[current_file] = 0;
+					++current_file;
+				}
 				/*
 				 * At this point we just have to read the remaining files. This
 				 * is the only way to get the total number of files using
-				 * Chan's generic FatFS module. We don't have to do this every
-				 * time while we are in the same directory, but for now we'll
-				 * do it this way because it is fast enough and simple too.
+				 * Chan's generic FatFS module. It's only done the first time
+				 * we reach the end of the directory, afterwards the count is
+				 * taken from the checkpoints.
 				 */
+				if (proceed && checkpoints.total != 0xFFFF) {
+					total_files = checkpoints.total;
+					proceed = 0;
+				}
 				while (proceed) {
+					checkpoint_record(&directory, total_files);
 					result = f_readdir(&directory, &file);
 					if (file.fname[0] == 0 || result != FR_OK) {
 						proceed = 0;
 					}
 					else ++total_files;
 				}
+				if (result == FR_OK && !sorted) checkpoints.total = total_files;
 				/*
 				 * What follows are proceedings to draw a scroll bar, which
 				 * will show, proportionally, the amount of files above, below
 				 * and the 10 (or less) files displayed on screen. If there 10
 				 * or less files, then 100% of files are shown and there is
 				 * almost nothing to determine. Else we'll have to calculate
-				 * the percentages.
+				 * the percentages. With the letter strip shown, it's 8 files.
 				 */
 				uint16_t empty_area1, filled_area, empty_area2;
-				if (total_files <= 10) {
+				if (total_files <= rows) {
 					empty_area1 = 0;
 					filled_area = 192;
 					empty_area2 = 0;
 				}
 				else {
-					float percentage = (float)10/(float)total_files;
+					float percentage = (float)rows/(float)total_files;
 					percentage = (float)192*percentage;
 					filled_area = (uint16_t)percentage;
-					if (cursors[depth]) {
-						percentage = (float)cursors[depth]/(float)total_files;
+					if (*cursor) {
+						percentage = (float)*cursor/(float)total_files;
 						percentage = (float)192*percentage;
 						empty_area1 = (uint16_t)percentage;
 					}
@@ -655,7 +931,7 @@ uint8_t file_manager() {
 						empty_area1 = 0;
 					}
 				}
-				if (total_files > 10 && cursors[depth] < total_files - 10)
+				if (total_files > rows && *cursor < total_files - rows)
 					empty_area2 = 192 - empty_area1 - filled_area;
 				else empty_area2 = 0;
 				if (empty_area1) {
@@ -695,8 +971,33 @@ uint8_t file_manager() {
 			}
 		}
 		/*
-		 * Now we'll check if there is a new order from user. This is the only
-		 * thing that this loop does repeatedly.
+		 * The rows are shown with the names of the files first. Then, on
+		 * every pass of this loop, the tags of one of the audio files on
+		 * screen are read and its row is written again.
+		 *
+		 * Otherwise the directory is sorted a bit on every pass of this loop,
+		 * so the user can keep scrolling meanwhile. Once it's sorted it's
+		 * shown again in the new order. When there's nothing to sort, the
+		 * catalog of the card is built the same way, if it's not ready.
+		 */
+		for (current_file = 0; current_file < rows; ++current_file) {
+			if (file_list[current_file].exists
+					&& file_list[current_file].tags_pending)
+				break;
+		}
+		if (current_file < rows && !new_order) {
+			tags_load(level->sclust, file_list[current_file].fname);
+			show_entry(&file_list[current_file], &filename_lenght[current_file],
+					32 + current_file*24, level->sclust);
+		}
+		else if (listing_busy()) {
+			if (listing_step()) new_order = 1;
+			//The spill files of a big directory are closed once it's done.
+			if (!listing_busy()) catalog_restamp();
+		}
+		else catalog_step(detect_touch);
+		/*
+		 * Now we'll check if there is a new order from user.
 		 */
 		if (detect_touch()) {
 			/*
@@ -727,8 +1028,8 @@ uint8_t file_manager() {
 					 */
 					if ((x >= arrow_up.x_start) && (x <= arrow_up.x_end) &&
 							(y >= arrow_up.y_start) && (y <= arrow_up.y_end)) {
-						if (cursors[depth] > 0) {
-							--cursors[depth];
+						if (*cursor > 0) {
+							--*cursor;
 							paint_imageLCD((uint16_t*)arrow_up_pressed_image,
 									arrow_up.x_start, arrow_up.y_start);
 							arrow_up_button_pressed = 1;
@@ -738,51 +1039,96 @@ uint8_t file_manager() {
 					if ((x >= arrow_down.x_start) && (x <= arrow_down.x_end) &&
 							(y >= arrow_down.y_start) &&
 							(y <= arrow_down.y_end)) {
-						if (cursors[depth] < total_files - 10) {
-							++cursors[depth];
+						if (*cursor < total_files - rows) {
+							++*cursor;
 							paint_imageLCD((uint16_t*)arrow_down_pressed_image,
 									arrow_down.x_start, arrow_down.y_start);
 							arrow_down_button_pressed = 1;
 							new_order = 1;
 						}
 					}
-					if ((x >= files_menu.x_start) && (x <= files_menu.x_end) &&
+					if ((x >= letter_rail.x_start) && (x <= letter_rail.x_end) &&
+							(y >= letter_rail.y_start) &&
+							(y <= letter_rail.y_end) &&
+							listing_ready() && !listing_filter_length()) {
+						uint8_t letter = (y - letter_rail.y_start)*26/
+								(letter_rail.y_end - letter_rail.y_start + 1);
+						level->cursor = listing_letter_position('A' + letter);
+						new_order = 1;
+					}
+					/*
+					 * The "Find" button shows or hides the letter strip.
+					 * Hiding it drops the filter.
+					 */
+					if ((x >= find_button.x_start) && (x <= find_button.x_end) &&
+							(y >= find_button.y_start) &&
+							(y <= find_button.y_end)) {
+						strip_shown = !strip_shown;
+						rows = strip_shown ? 8 : 10;
+						listing_filter_clear();
+						filter_cursor = 0;
+						show_filter_strip(strip_shown);
+						new_order = 1;
+					}
+					/*
+					 * A key of the letter strip adds its letter to the filter
+					 * or removes the last one. The filtered entries are shown
+					 * from the first one.
+					 */
+					if (strip_shown && (x >= filter_strip.x_start) &&
+							(x <= filter_strip.x_end) &&
+							(y >= filter_strip.y_start) &&
+							(y <= filter_strip.y_end)) {
+						char key = filter_keys[(y - filter_strip.y_start)/24*
+								FILTER_STRIP_COLUMNS + x/32];
+						if (key == '<') listing_filter_remove();
+						else listing_filter_add(key == '_' ? ' ' : key);
+						filter_cursor = 0;
+						new_order = 1;
+					}
+					/*
+					 * Touching the "dir" label of a directory plays all of
+					 * its tree instead of entering it.
+					 */
+					else if ((x >= tree_labels.x_start) &&
+							(x <= tree_labels.x_end) &&
+							(y >= tree_labels.y_start) &&
+							(y <= tree_labels.y_end)) {
+						uint8_t selected_file = (y - tree_labels.y_start)/files_menu.step;
+						if (selected_file < rows &&
+								file_list[selected_file].exists &&
+								file_list[selected_file].fattrib == AM_DIR) {
+							mem_cpy(target_file,
+									file_list[selected_file].fname, 13);
+							return PLAY_TREE;
+						}
+					}
+					else if ((x >= files_menu.x_start) && (x <= files_menu.x_end) &&
 							(y >= files_menu.y_start) &&
 							(y <= files_menu.y_end)) {
 						uint8_t selected_file = (y - files_menu.y_start)/files_menu.step;
 						if (file_list[selected_file].exists) {
 							if (file_list[selected_file].fattrib == AM_DIR) {
-								if (depth == 49) {
-									write_phraseLCD("Not enough memory to go so deep!",
-											32, 0, 0, 0x0000, 0xFFFF);
-									current_directory_path[0] = '.';
-									current_directory_path[1] = 0;
-								}
-								else {
-									++depth;
-									mem_cpy(&visited_directories[depth][0],
-											file_list[selected_file].fname,
-											13);
-									cursors[depth] = 0;
-									current_directory_path[0] = '.';
-									current_directory_path[1] = '/';
-									mem_cpy(&current_directory_path[2],
-											file_list[selected_file].fname,
-											13);
-								}
-								if (f_chdir(current_directory_path) == FR_OK) {
+								FRESULT result = navigation_enter(
+										file_list[selected_file].fname,
+										file_list[selected_file].long_name);
+								if (result == FR_OK) {
+									level = navigation_current();
 									paint_areaLCD(24, 0, 200, 31, 0xFFFF);
-									write_phraseLCD(&visited_directories[depth][0],
-											13, 29, 0, 0x0000, 0xFFFF);
+									write_phrase_limitedLCD(level->name,
+											level->name_length, 29, 0, 200,
+											0x0000, 0xFFFF);
 									new_order = 1;
-									current_directory_path[0] = '.';
-									current_directory_path[1] = 0;
+								}
+								else if (result == FR_NOT_ENOUGH_CORE) {
+									write_phraseLCD("Not enough memory to go so deep!",
+											32, 0, 0, 0x0000, 0xFFFF);
 								}
 								else {
 									write_phraseLCD("Error!", 6, 0, 0, 0x0000,
 											0xFFFF);
-									write_phraseLCD(current_directory_path, 13,
-											100, 0, 0x0000, 0xFFFF);
+									write_phraseLCD(file_list[selected_file].fname,
+											13, 100, 0, 0x0000, 0xFFFF);
 								}
 							}
 							else {
@@ -800,29 +1146,23 @@ uint8_t file_manager() {
 					if ((x >= folder_up.x_start) && (x <= folder_up.x_end) &&
 							(y >= folder_up.y_start) &&
 							(y <= folder_up.y_end)) {
-						if (depth > 0) {
-							--depth;
-							current_directory_path[0] = '.';
-							current_directory_path[1] = '/';
-							current_directory_path[2] = '.';
-							current_directory_path[3] = '.';
-							current_directory_path[4] = 0;
-							if (f_chdir(current_directory_path) == FR_OK) {
+						if (navigation_depth() > 0) {
+							if (navigation_leave() == FR_OK) {
+								level = navigation_current();
 								paint_imageLCD((uint16_t*)folder_up_pressed_image,
 										0, 0);
 								folder_up_button_pressed = 1;
 								paint_areaLCD(24, 0, 200, 31, 0xFFFF);
-								write_phraseLCD(&visited_directories[depth][0],
-										13, 29, 0, 0x0000, 0xFFFF);
+								write_phrase_limitedLCD(level->name,
+										level->name_length, 29, 0, 200,
+										0x0000, 0xFFFF);
 								new_order = 1;
-								current_directory_path[0] = '.';
-								current_directory_path[1] = 0;
 							}
 							else {
 								write_phraseLCD("Error!", 6, 0, 0, 0x0000,
 										0xFFFF);
-								write_phraseLCD(current_directory_path, 13,
-										100, 0, 0x0000, 0xFFFF);
+								write_phraseLCD("..", 2, 100, 0, 0x0000,
+										0xFFFF);
 							}
 						}
 					}
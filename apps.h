@@ -32,12 +32,26 @@
 
 #define NO_SDCARD 0
 #define OPEN_FILE 1
+#define PLAY_TREE 2
+
+/*
+ * Directory checkpoints used by the file manager. A copy of the DIR object is
+ * saved every DIR_CHECKPOINT_INTERVAL entries of the current directory, up to
+ * DIR_CHECKPOINTS copies. When the table is full the interval is doubled, so
+ * the memory used is fixed no matter how big the directory is.
+ */
+#define DIR_CHECKPOINTS 32
+#define DIR_CHECKPOINT_INTERVAL 16
+
+/*
+ * The letter strip of the file manager's filter: 2 rows of keys, 32 pixels
+ * wide, below the last 8 entries.
+ */
+#define FILTER_STRIP_COLUMNS 14
+#define FILTER_STRIP_Y 224
 
 extern char current_directory_path[20];
-extern char visited_directories[50][13];
 extern char target_file[13];
-extern uint16_t cursors[50];
-extern uint8_t depth;
 
 extern const uint16_t arrow_up_image[];
 extern const uint16_t arrow_down_image[];
@@ -48,12 +62,32 @@ extern const uint16_t folder_up_pressed_image[];
 
 /*
  * Struct that serves to display and identify the files presented in file
- * manager's menu that lists the file in a directory.
+ * manager's menu that lists the file in a directory. The 8.3 name is the one
+ * used to open it, the long name, if any, lives in the name arena (see
+ * names.c) and is only shown. An audio file whose tags are still to be read
+ * is marked as pending.
  */
 struct Menu_object {
 	BYTE	fattrib;
 	TCHAR	fname[13];
+	const char* long_name;
 	uint8_t exists;
+	uint8_t tags_pending;
+};
+
+/*
+ * Checkpoints of the directory currently displayed by the file manager. The
+ * directory is identified by its start cluster and the mount ID of the file
+ * system, so a remounted card never reuses stale positions. Total is 0xFFFF
+ * until the whole directory was read once.
+ */
+struct Dir_checkpoints {
+	WORD	id;
+	DWORD	sclust;
+	uint16_t total;
+	uint16_t interval;
+	uint8_t count;
+	DIR		points[DIR_CHECKPOINTS];
 };
 
 /*
@@ -0,0 +1,898 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * BENCHMARKS:
+ * Those are stand-alone routines, just like the touch panel tests in touch.c,
+ * that are not used by the player itself. They measure how long different
+ * parts of the system take using the cycle counter (see delay.c) and show
+ * the results on the screen. To run one of them uncomment its call in main.c.
+ *
+ * The storage workloads (playback, directory scan and text pages) can also be
+ * run on a PC against an image of the card, using the image backend of
+ * diskio.c, which counts the commands and sectors read and adds up a modeled
+ * access time for them instead of measuring it:
+ *
+ *   gcc -D_DISK_IMAGE -I. -I"Filesystem layer" benchmarks.c listing.c names.c
+ *       "Filesystem layer/ff.c" "Filesystem layer/ccsbcs.c"
+ *       "Filesystem layer/diskio.c" -o benchmarks
+ *   ./benchmarks card.img [command_us sector_us]
+ *
+ * The sort benchmark writes to the card (see BENCHMARK_SORT_DIRECTORY), so on
+ * the PC it's better run on a copy of the image.
+ */
+
+#include <benchmarks.h>
+#include <diskio.h>
+#include <ff.h>
+#include <listing.h>
+#include <names.h>
+#ifdef _DISK_IMAGE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define mem_cpy(dst,src,cnt) memcpy(dst,src,cnt)
+#else
+#include <catalog.h>
+#include <delay.h>
+#include <lcd.h>
+#include <player.h>
+#include <touch.h>
+#include <utils.h>
+#endif
+
+static FATFS benchmark_fs;
+static uint8_t benchmark_buffer[BENCHMARK_BURST_SECTORS * 512] __attribute__ ((aligned (16)));
+#ifndef _DISK_IMAGE
+static uint32_t workload_start;
+#endif
+
+/*
+ * Makes an absolute path for an entry of the root directory.
+ */
+static void path_in_root(TCHAR* name, char* path) {
+	path[0] = '/';
+	mem_cpy(path + 1, name, 13);
+}
+
+/*
+ * Replays the reads made while browsing the card: the file manager lists the
+ * whole directory every time it's scrolled, so the root directory is listed
+ * BENCHMARK_BROWSE_STEPS times, and then every directory found in it is
+ * entered and listed once, like when the user opens them one after another.
+ */
+static void replay_browsing() {
+	DIR directory;
+	FILINFO file;
+	uint16_t step;
+
+	file.lfname = 0;
+	for (step = 0; step < BENCHMARK_BROWSE_STEPS; ++step) {
+		if (f_opendir(&directory, "/") != FR_OK) return;
+		while (f_readdir(&directory, &file) == FR_OK && file.fname[0]);
+	}
+
+	if (f_opendir(&directory, "/") != FR_OK) return;
+	while (f_readdir(&directory, &file) == FR_OK && file.fname[0]) {
+		if (file.fattrib & AM_DIR) {
+			DIR subdirectory;
+			FILINFO subfile;
+			char path[14];
+
+			subfile.lfname = 0;
+			path_in_root(file.fname, path);
+			if (f_opendir(&subdirectory, path) == FR_OK) {
+				while (f_readdir(&subdirectory, &subfile) == FR_OK && subfile.fname[0]);
+			}
+		}
+	}
+}
+
+/*
+ * Starts counting the reads of a workload.
+ */
+static void start_workload() {
+	disk_reset_stats(0);
+#ifndef _DISK_IMAGE
+	workload_start = get_cycles();
+#endif
+}
+
+/*
+ * Time since start_workload(). On the PC it's the time modeled by the image
+ * backend.
+ */
+static uint32_t workload_time_us() {
+#ifdef _DISK_IMAGE
+	DSTATS stats;
+
+	disk_get_stats(0, &stats);
+	return stats.modeled_us;
+#else
+	return cycles_to_us(get_cycles() - workload_start);
+#endif
+}
+
+/*
+ * Stores the reads made since start_workload() and the time they took.
+ */
+static void finish_workload(struct Workload_result* result) {
+	DSTATS stats;
+
+	disk_get_stats(0, &stats);
+	result->commands = stats.read_commands;
+	result->sectors = stats.sectors_read;
+	result->time_us = workload_time_us();
+}
+
+/*
+ * Looks in the root directory for the files used by the workloads: the
+ * biggest file stands for a song and the first .TXT file for a text. If there
+ * is no text file the song is used instead. Returns 0 if there are no files.
+ */
+static uint8_t find_workload_files(char* song, char* text) {
+	DIR directory;
+	FILINFO file;
+	DWORD biggest = 0;
+
+	file.lfname = 0;
+	song[0] = 0;
+	text[0] = 0;
+	if (f_opendir(&directory, "/") != FR_OK) return 0;
+	while (f_readdir(&directory, &file) == FR_OK && file.fname[0]) {
+		if (file.fattrib & AM_DIR) continue;
+		if (file.fsize > biggest) {
+			biggest = file.fsize;
+			path_in_root(file.fname, song);
+		}
+		if (!text[0]) {
+			uint16_t i = 0;
+			while (file.fname[i] && file.fname[i] != '.') ++i;
+			if (file.fname[i] == '.' && file.fname[i + 1] == 'T'
+					&& file.fname[i + 2] == 'X' && file.fname[i + 3] == 'T')
+				path_in_root(file.fname, text);
+		}
+	}
+	if (!song[0]) return 0;
+	if (!text[0]) mem_cpy(text, song, 14);
+	return 1;
+}
+
+/*
+ * Reads a song from the beginning the way the player does, "chunk" bytes at
+ * a time, up to BENCHMARK_PLAYBACK_BYTES.
+ */
+static uint8_t workload_playback(char* path, UINT chunk,
+		struct Workload_result* result) {
+	FIL file;
+	UINT number_bytes;
+	DWORD total = 0;
+
+	if (f_open(&file, path, FA_READ | FA_OPEN_EXISTING) != FR_OK) return 0;
+	start_workload();
+	do {
+		if (f_read(&file, benchmark_buffer, chunk, &number_bytes) != FR_OK) break;
+		total += number_bytes;
+	} while (number_bytes == chunk && total < BENCHMARK_PLAYBACK_BYTES);
+	finish_workload(result);
+	f_close(&file);
+	return 1;
+}
+
+/*
+ * Lists the root directory and every directory found in it, the way the
+ * file manager does when it's opened (see replay_browsing()).
+ */
+static void workload_directory_scan(struct Workload_result* result) {
+	start_workload();
+	replay_browsing();
+	finish_workload(result);
+}
+
+/*
+ * Reads a text the way txt_viewer() in apps.c does: first the whole file is
+ * read 512 bytes at a time to split it into pages, then every page is shown
+ * going forward and then back, each one with a seek and a 512 bytes read.
+ * The pages are taken BENCHMARK_TEXT_PAGE_BYTES apart, which is about what
+ * fits on the screen, and there are at most BENCHMARK_TEXT_PAGES of them.
+ */
+static uint8_t workload_text_pages(char* path, struct Workload_result* result) {
+	FIL file;
+	UINT number_bytes;
+	DWORD size;
+	uint16_t pages = 0;
+	uint16_t page;
+
+	if (f_open(&file, path, FA_READ | FA_OPEN_EXISTING) != FR_OK) return 0;
+	size = f_size(&file);
+	start_workload();
+
+	do {
+		if (f_read(&file, benchmark_buffer, 512, &number_bytes) != FR_OK) break;
+		while (pages < BENCHMARK_TEXT_PAGES
+				&& (DWORD)pages * BENCHMARK_TEXT_PAGE_BYTES < f_tell(&file))
+			++pages;
+	} while (number_bytes == 512 && pages < BENCHMARK_TEXT_PAGES);
+
+	for (page = 0; page < 2 * pages; ++page) {
+		DWORD offset = (page < pages ? page : 2 * pages - 1 - page)
+				* BENCHMARK_TEXT_PAGE_BYTES;
+		if (offset >= size) continue;
+		if (f_lseek(&file, offset) != FR_OK) break;
+		if (f_read(&file, benchmark_buffer, 512, &number_bytes) != FR_OK) break;
+	}
+
+	finish_workload(result);
+	f_close(&file);
+	return 1;
+}
+
+/*
+ * Sizes of the directory sorted by the sort benchmark.
+ */
+static const uint16_t sort_sizes[] = {100, 500, 1000, 2000, 5000, 10000};
+
+/*
+ * Adds empty files to BENCHMARK_SORT_DIRECTORY until it has "count" of them.
+ * The names hold numbers taken in a scrambled order, so the directory isn't
+ * sorted already, and they are long names, so they take room in the name
+ * arena like the ones of a real library.
+ */
+static uint8_t fill_sort_directory(uint16_t count) {
+	char path[] = BENCHMARK_SORT_DIRECTORY "/Song 00000 - Sort benchmark.mp3";
+	uint16_t digits = sizeof(BENCHMARK_SORT_DIRECTORY) + 5;
+	uint16_t i;
+	FRESULT result = f_mkdir(BENCHMARK_SORT_DIRECTORY);
+
+	if (result != FR_OK && result != FR_EXIST) return 0;
+	for (i = 0; i < count; ++i) {
+		FIL file;
+		uint32_t number = ((uint32_t)i * 7919) % 100000;
+		int8_t j;
+		for (j = 4; j >= 0; --j) {
+			path[digits + j] = '0' + number % 10;
+			number /= 10;
+		}
+		if (f_open(&file, path, FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) return 0;
+		f_close(&file);
+	}
+	return 1;
+}
+
+/*
+ * Sorts BENCHMARK_SORT_DIRECTORY the way the file manager does, one call to
+ * listing_step() at a time, timing every one of them. Then types
+ * BENCHMARK_FILTER into the filter, timing every character.
+ */
+static uint8_t workload_listing_sort(struct Sort_result* result) {
+	struct Names_stats names;
+	const char* filter = BENCHMARK_FILTER;
+	uint32_t before = 0;
+
+	result->steps = 0;
+	result->longest_step_us = 0;
+	listing_close();
+	names_reset_stats();
+	start_workload();
+	listing_open(BENCHMARK_SORT_DIRECTORY);
+	while (listing_busy()) {
+		uint32_t now;
+		listing_step();
+		now = workload_time_us();
+		++result->steps;
+		if (now - before > result->longest_step_us)
+			result->longest_step_us = now - before;
+		before = now;
+	}
+	finish_workload(&result->total);
+	names_get_stats(&names);
+	result->entries = listing_entries();
+	result->name_bytes = names.directory_high_water;
+	result->name_overflows = names.overflows;
+
+	result->longest_filter_us = 0;
+	start_workload();
+	before = 0;
+	while (*filter) {
+		uint32_t now;
+		listing_filter_add(*filter++);
+		now = workload_time_us();
+		if (now - before > result->longest_filter_us)
+			result->longest_filter_us = now - before;
+		before = now;
+	}
+	result->filtered = listing_filtered_entries();
+	listing_filter_clear();
+	return listing_ready();
+}
+
+#ifdef _DISK_IMAGE
+/*
+ * Prints the results of a workload.
+ */
+static void print_workload(const char* label, struct Workload_result* result) {
+	printf("%-20s %8lu reads %8lu sectors %10lu us\n", label,
+			(unsigned long)result->commands, (unsigned long)result->sectors,
+			(unsigned long)result->time_us);
+}
+
+int main(int argc, char* argv[]) {
+	struct Workload_result result;
+	uint8_t i;
+	DSTATS stats;
+	char song[14];
+	char text[14];
+
+	if (argc != 2 && argc != 4) {
+		printf("Usage: %s image [command_us sector_us]\n", argv[0]);
+		return 1;
+	}
+	disk_image_open(argv[1]);
+	if (argc == 4)
+		disk_set_latency(atol(argv[2]), atol(argv[3]));
+	else
+		disk_set_latency(BENCHMARK_COMMAND_US, BENCHMARK_SECTOR_US);
+
+	if (f_mount(&benchmark_fs, "0:", 1) != FR_OK) {
+		printf("Couldn't mount %s.\n", argv[1]);
+		return 1;
+	}
+	if (!find_workload_files(song, text)) {
+		printf("No files in the root directory.\n");
+		return 1;
+	}
+
+	if (workload_playback(song, 512, &result))
+		print_workload("Playback 512:", &result);
+	if (workload_playback(song, BENCHMARK_BURST_SECTORS * 512, &result))
+		print_workload("Playback 4096:", &result);
+	workload_directory_scan(&result);
+	print_workload("Directory scan:", &result);
+	disk_get_stats(0, &stats);
+	printf("%-20s %8lu hits %9lu misses\n", "Sector cache:",
+			(unsigned long)stats.cache_hits, (unsigned long)stats.cache_misses);
+	if (workload_text_pages(text, &result))
+		print_workload("Text pages:", &result);
+
+	for (i = 0; i < sizeof(sort_sizes) / sizeof(sort_sizes[0]); ++i) {
+		struct Sort_result sort;
+		if (!fill_sort_directory(sort_sizes[i])) {
+			printf("Couldn't fill %s.\n", BENCHMARK_SORT_DIRECTORY);
+			break;
+		}
+		if (!workload_listing_sort(&sort)) {
+			printf("Couldn't sort %s.\n", BENCHMARK_SORT_DIRECTORY);
+			break;
+		}
+		printf("Sort %5lu entries: %6lu steps %8lu us longest %10lu us %8lu reads\n",
+				(unsigned long)sort.entries, (unsigned long)sort.steps,
+				(unsigned long)sort.longest_step_us,
+				(unsigned long)sort.total.time_us,
+				(unsigned long)sort.total.commands);
+		printf("%-20s %8lu bytes of %u, %lu names didn't fit\n", "Name arena:",
+				(unsigned long)sort.name_bytes, NAMES_ARENA_SIZE,
+				(unsigned long)sort.name_overflows);
+		printf("%-20s %8lu us longest %6lu entries left\n", "Filter:",
+				(unsigned long)sort.longest_filter_us,
+				(unsigned long)sort.filtered);
+	}
+
+	return 0;
+}
+#else
+/*
+ * Writes a line like "Single block: 1234 KB/s" on the specified row of the
+ * screen.
+ */
+static void write_result(char* label, uint16_t label_length, uint32_t value,
+		char* unit, uint16_t unit_length, uint16_t y) {
+	char s[11];
+	itoa32bits(value, s);
+	s[10] = 0;
+	uint16_t x = write_phraseLCD(label, label_length, 0, y, 0x0000, 0xFFFF);
+	x = write_numberLCD(s, 10, x + 8, y, 0x0000, 0xFFFF);
+	write_phraseLCD(unit, unit_length, x + 8, y, 0x0000, 0xFFFF);
+}
+
+/*
+ * Writes the results of a workload on the specified row of the screen.
+ */
+static void write_workload(char* label, uint16_t label_length,
+		struct Workload_result* result, uint16_t y) {
+	char s[11];
+	uint16_t x = write_phraseLCD(label, label_length, 0, y, 0x0000, 0xFFFF);
+	itoa32bits(result->commands, s);
+	x = write_numberLCD(s, 10, x + 8, y, 0x0000, 0xFFFF);
+	itoa32bits(result->sectors, s);
+	x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+	itoa32bits(result->time_us / 1000, s);
+	write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+}
+
+/*
+ * Reads BENCHMARK_SECTORS sectors through disk_read(), "sectors_per_read" at
+ * a time, and returns the throughput in KB/s or 0 if any read failed.
+ */
+static uint32_t measure_reads(UINT sectors_per_read) {
+	DWORD sector;
+	uint32_t start = get_cycles();
+
+	for (sector = BENCHMARK_FIRST_SECTOR;
+			sector < BENCHMARK_FIRST_SECTOR + BENCHMARK_SECTORS;
+			sector += sectors_per_read) {
+		if (disk_read(0, benchmark_buffer, sector, sectors_per_read) != RES_OK)
+			return 0;
+	}
+
+	uint32_t ms = cycles_to_us(get_cycles() - start) / 1000;
+	if (ms == 0) ms = 1;
+
+	return (BENCHMARK_SECTORS / 2) * 1000 / ms;
+}
+
+/*
+ * Compares reading the same area of the card one sector per command (CMD17)
+ * with reading it in bursts of BENCHMARK_BURST_SECTORS sectors per command
+ * (CMD18 followed by CMD12). The difference is the cost of issuing a command
+ * and waiting for the card's access time before every single sector. The bus
+ * width and clock negotiated by SD_Init() are shown first, with the
+ * throughput measured by disk_initialize() with them, and the read errors
+ * counted by diskio.c since the start last.
+ */
+void test_sd_throughput() {
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("SD card read throughput", 23, 0, 0, 0x0000, 0xFFFF);
+
+	if (!SDCard_present() || disk_initialize(0) != RES_OK) {
+		write_phraseLCD("No SD card available.", 21, 0, 24, 0x0000, 0xFFFF);
+		return;
+	}
+
+	DBUSINFO bus;
+	disk_get_bus_info(0, &bus);
+	write_result("Bus width:", 10, bus.bus_width, "bits", 4, 24);
+	if (bus.high_speed)
+		write_result("Clock:", 6, bus.clock_khz, "kHz, high speed", 15, 48);
+	else
+		write_result("Clock:", 6, bus.clock_khz, "kHz", 3, 48);
+	write_result("At mount:", 9, bus.read_kbps, "KB/s", 4, 72);
+
+	Cycle_counter_Init();
+
+	write_result("Single block:", 13, measure_reads(1), "KB/s", 4, 96);
+	write_result("Multiple block:", 15, measure_reads(BENCHMARK_BURST_SECTORS),
+			"KB/s", 4, 120);
+
+	DERRSTATS errors;
+	disk_get_errors(0, &errors);
+	write_result("CRC errors:", 11, errors.crc_errors, "", 0, 168);
+	write_result("Timeouts:", 9, errors.timeouts, "", 0, 192);
+	write_result("Recovered reads:", 16, errors.recovered, "", 0, 216);
+	write_result("Failed reads:", 13, errors.failed, "", 0, 240);
+}
+
+/*
+ * Mounts the card for the benchmarks that go through FatFs. Returns 0 and
+ * explains why on the screen if it's not possible.
+ */
+static uint8_t mount_card() {
+	if (!SDCard_present() || f_mount(&benchmark_fs, "0:", 1) != FR_OK) {
+		write_phraseLCD("Couldn't mount the SD card.", 27, 0, 24, 0x0000, 0xFFFF);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Shows how many sector reads made while browsing the card are served by the
+ * sector cache in diskio.c. Change _DISK_CACHE_SECTORS in diskio.h to compare
+ * different cache sizes.
+ */
+void test_disk_cache() {
+	DSTATS stats;
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("Sector cache hit rate", 21, 0, 0, 0x0000, 0xFFFF);
+
+	if (!mount_card()) return;
+
+	disk_reset_stats(0);
+	replay_browsing();
+	disk_get_stats(0, &stats);
+
+	write_result("Cache hits:", 11, stats.cache_hits, "", 0, 48);
+	write_result("Cache misses:", 13, stats.cache_misses, "", 0, 72);
+	uint32_t total = stats.cache_hits + stats.cache_misses;
+	write_result("Hit rate:", 9, total ? stats.cache_hits * 100 / total : 0,
+			"%", 1, 96);
+	write_result("Card reads:", 11, stats.read_commands, "", 0, 120);
+}
+
+/*
+ * Seeks BENCHMARK_SEEKS times to pseudo-random sector boundaries of an open
+ * file and returns the average time of a seek in microseconds. The number of
+ * reads sent to the card meanwhile is stored in "card_reads".
+ */
+static uint32_t measure_seeks(FIL* file, uint32_t* card_reads) {
+	DSTATS stats;
+	uint32_t seed = 1;
+	uint32_t sectors = f_size(file) / 512;
+	uint16_t i;
+
+	f_lseek(file, 0);
+	disk_reset_stats(0);
+	uint32_t start = get_cycles();
+
+	for (i = 0; i < BENCHMARK_SEEKS; ++i) {
+		seed = seed * 1103515245 + 12345;
+		f_lseek(file, ((seed >> 8) % sectors) * 512);
+	}
+
+	uint32_t us = cycles_to_us(get_cycles() - start);
+	disk_get_stats(0, &stats);
+	*card_reads = stats.read_commands;
+
+	return us / BENCHMARK_SEEKS;
+}
+
+/*
+ * Compares the seek latency with and without a cluster link map (see
+ * attach_link_map() in utils.c) for the files found in the root directory.
+ * Every row shows the size of a file, and the time per seek and the reads
+ * sent to the card without the map and then with the map. Without it the
+ * cost grows with the size of the file, with it the cost should be the same
+ * for every file.
+ */
+void test_seek_latency() {
+	DIR directory;
+	FILINFO info;
+	FIL file;
+	uint16_t y = 24;
+	uint32_t us, reads;
+	char path[14];
+	char s[11];
+
+	info.lfname = 0;
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("Seek: KB, us/reads, map us/reads", 32, 0, 0, 0x0000, 0xFFFF);
+
+	if (!mount_card()) return;
+	if (f_opendir(&directory, "/") != FR_OK) return;
+
+	Cycle_counter_Init();
+
+	while (y < 272 && f_readdir(&directory, &info) == FR_OK && info.fname[0]) {
+		if ((info.fattrib & AM_DIR) || info.fsize < BENCHMARK_MIN_SEEK_FILE_SIZE)
+			continue;
+		path_in_root(info.fname, path);
+		if (f_open(&file, path, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+			continue;
+
+		itoa32bits(info.fsize / 1024, s);
+		uint16_t x = write_numberLCD(s, 10, 0, y, 0x0000, 0xFFFF);
+
+		us = measure_seeks(&file, &reads);
+		itoa32bits(us, s);
+		x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+		itoa32bits(reads, s);
+		x = write_numberLCD(s, 10, x + 8, y, 0x0000, 0xFFFF);
+
+		if (attach_link_map(&file)) {
+			us = measure_seeks(&file, &reads);
+			itoa32bits(us, s);
+			x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+			itoa32bits(reads, s);
+			write_numberLCD(s, 10, x + 8, y, 0x0000, 0xFFFF);
+			release_link_map(&file);
+		}
+		else {
+			write_phraseLCD("no map", 6, x + 16, y, 0x0000, 0xFFFF);
+		}
+
+		f_close(&file);
+		y += 24;
+	}
+}
+
+/*
+ * Runs the storage workloads on the card and shows, for every one, the reads
+ * sent to the card, the sectors read and the time they took in ms.
+ */
+void test_storage_workloads() {
+	struct Workload_result result;
+	char song[14];
+	char text[14];
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("Workloads: reads, sectors, ms", 29, 0, 0, 0x0000, 0xFFFF);
+
+	if (!mount_card()) return;
+	if (!find_workload_files(song, text)) {
+		write_phraseLCD("No files in the root directory.", 31, 0, 24, 0x0000, 0xFFFF);
+		return;
+	}
+
+	Cycle_counter_Init();
+
+	if (workload_playback(song, 512, &result))
+		write_workload("Play 512:", 9, &result, 48);
+	if (workload_playback(song, BENCHMARK_BURST_SECTORS * 512, &result))
+		write_workload("Play 4096:", 10, &result, 72);
+	workload_directory_scan(&result);
+	write_workload("Directories:", 12, &result, 96);
+	if (workload_text_pages(text, &result))
+		write_workload("Text pages:", 11, &result, 120);
+}
+
+/*
+ * Sorts BENCHMARK_SORT_DIRECTORY for each of the sizes in sort_sizes and
+ * shows, for each one, the entries, the steps the sort was split in, the
+ * longest step in us, the total time in ms, the high water mark of the
+ * name arena and the longest time in us to filter it by one character.
+ */
+void test_listing_sort() {
+	struct Sort_result sort;
+	uint16_t y = 24;
+	uint8_t i;
+	char s[11];
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("Sort: entries, steps, max us, ms, name bytes, filter us",
+			55, 0, 0, 0x0000, 0xFFFF);
+
+	if (!mount_card()) return;
+	Cycle_counter_Init();
+
+	for (i = 0; i < sizeof(sort_sizes) / sizeof(sort_sizes[0]); ++i) {
+		uint16_t x;
+		if (!fill_sort_directory(sort_sizes[i]) || !workload_listing_sort(&sort)) {
+			write_phraseLCD("Failed!", 7, 0, y, 0x0000, 0xFFFF);
+			return;
+		}
+		itoa32bits(sort.entries, s);
+		x = write_numberLCD(s, 10, 0, y, 0x0000, 0xFFFF);
+		itoa32bits(sort.steps, s);
+		x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+		itoa32bits(sort.longest_step_us, s);
+		x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+		itoa32bits(sort.total.time_us / 1000, s);
+		x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+		itoa32bits(sort.name_bytes, s);
+		x = write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+		itoa32bits(sort.longest_filter_us, s);
+		write_numberLCD(s, 10, x + 16, y, 0x0000, 0xFFFF);
+		y += 24;
+	}
+}
+
+/*
+ * Builds the catalog of the card from scratch, one catalog_step() after
+ * another, like the file manager does when it's idle. Every 100 steps it
+ * shows the directories and the audio files found so far, the entries read
+ * per second and the longest step in us. Touching the screen ends it.
+ */
+void test_catalog_indexer() {
+	struct Catalog_progress progress;
+	uint32_t steps = 0;
+	uint16_t x;
+	char s[11];
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("Catalog: directories, files, entries/s, longest us", 50, 0, 0,
+			0x0000, 0xFFFF);
+
+	if (!mount_card()) return;
+	Cycle_counter_Init();
+	f_unlink(CATALOG_FILE);
+	catalog_mount();
+
+	while (catalog_busy() && !detect_touch()) {
+		catalog_step(detect_touch);
+		if (++steps % 100 && catalog_busy()) continue;
+		catalog_get_progress(&progress);
+		itoa32bits(progress.directories, s);
+		x = write_numberLCD(s, 10, 0, 24, 0x0000, 0xFFFF);
+		itoa32bits(progress.files, s);
+		x = write_numberLCD(s, 10, x + 16, 24, 0x0000, 0xFFFF);
+		itoa32bits(progress.entries_per_second, s);
+		x = write_numberLCD(s, 10, x + 16, 24, 0x0000, 0xFFFF);
+		itoa32bits(progress.longest_step_us, s);
+		write_numberLCD(s, 10, x + 16, 24, 0x0000, 0xFFFF);
+	}
+	write_phraseLCD(catalog_ready() ? "Done." : "Stopped.",
+			catalog_ready() ? 5 : 8, 0, 48, 0x0000, 0xFFFF);
+}
+
+/*
+ * Finds the first FLAC file of the root directory, or else the biggest file
+ * of it. Returns 0 if there are no files.
+ */
+static uint8_t find_flac_file(char* path) {
+	DIR directory;
+	FILINFO file;
+	char text[14];
+
+	file.lfname = 0;
+	if (f_opendir(&directory, "/") != FR_OK) return 0;
+	while (f_readdir(&directory, &file) == FR_OK && file.fname[0]) {
+		if (!(file.fattrib & AM_DIR) && check_extension(file.fname, ".FLA", 4)) {
+			path_in_root(file.fname, path);
+			return 1;
+		}
+	}
+	return find_workload_files(path, text);
+}
+
+/*
+ * Sends the beginning of a file to the VS1053 the way the player does, 32
+ * bytes at a time as DREQ allows, by DMA or byte by byte. While a burst is
+ * being sent by DMA the CPU is free, the cycles it could spend elsewhere are
+ * counted in "free_cycles". The VS1053 is reset before and after.
+ */
+static uint8_t measure_sdi(char* path, uint8_t dma,
+		struct Sdi_statistics* statistics, uint32_t* free_cycles) {
+	FIL file;
+	UINT number_bytes;
+	UINT i;
+	DWORD total = 0;
+
+	if (f_open(&file, path, FA_READ | FA_OPEN_EXISTING) != FR_OK) return 0;
+	VSTestInitSoftware();
+	SdiUseDma(dma);
+	ResetSdiStatistics();
+	*free_cycles = 0;
+	do {
+		WaitSdi();
+		if (f_read(&file, benchmark_buffer, sizeof(benchmark_buffer),
+				&number_bytes) != FR_OK)
+			break;
+		for (i = 0; i < number_bytes; i += 32) {
+			WriteSdi(benchmark_buffer + i, number_bytes - i < 32 ? number_bytes - i : 32);
+			uint32_t start = get_cycles();
+			while (SdiBusy());
+			*free_cycles += get_cycles() - start;
+		}
+		total += number_bytes;
+	} while (number_bytes == sizeof(benchmark_buffer) && total < BENCHMARK_SDI_BYTES);
+	WaitSdi();
+	GetSdiStatistics(statistics);
+	f_close(&file);
+	VSTestInitSoftware();
+	SdiUseDma(1);
+	return 1;
+}
+
+/*
+ * Compares the CPU time spent moving SDI data to the VS1053 byte by byte,
+ * polling the SPI, and by DMA, for the first BENCHMARK_SDI_BYTES of a FLAC
+ * file. It shows, per KB sent, the cycles the CPU spent on the transfers,
+ * then the cycles it had free while the DMA worked. The time spent waiting
+ * for DREQ is the codec's pace, the same for both, and is shown in ms.
+ * Last come the SPI2 clocks chosen by VSTestInitSoftware() and the bytes
+ * per second sustained by the polled bursts while DREQ was high.
+ */
+void test_sdi_transport() {
+	struct Sdi_statistics polled;
+	struct Sdi_statistics dma;
+	uint32_t free_cycles;
+	uint32_t write_hz, read_hz;
+	uint32_t transport_us;
+	char path[14];
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("SDI transport, CPU cycles per KB", 32, 0, 0, 0x0000, 0xFFFF);
+
+	if (!mount_card()) return;
+	if (!find_flac_file(path)) {
+		write_phraseLCD("No files in the root directory.", 31, 0, 24, 0x0000, 0xFFFF);
+		return;
+	}
+
+	Cycle_counter_Init();
+
+	if (!measure_sdi(path, 0, &polled, &free_cycles) ||
+			!measure_sdi(path, 1, &dma, &free_cycles) ||
+			polled.bytes < 1024 || dma.bytes < 1024) {
+		write_phraseLCD("Couldn't read the file.", 23, 0, 24, 0x0000, 0xFFFF);
+		return;
+	}
+	write_result("Polled:", 7, polled.transport_cycles / (polled.bytes / 1024),
+			"cycles/KB", 9, 24);
+	write_result("DMA:", 4, dma.transport_cycles / (dma.bytes / 1024),
+			"cycles/KB", 9, 48);
+	write_result("Free during DMA:", 16, free_cycles / (dma.bytes / 1024),
+			"cycles/KB", 9, 72);
+	write_result("DREQ wait, polled:", 18, cycles_to_us(polled.dreq_cycles) / 1000,
+			"ms", 2, 96);
+	write_result("DREQ wait, DMA:", 15, cycles_to_us(dma.dreq_cycles) / 1000,
+			"ms", 2, 120);
+	GetSpiClocks(&write_hz, &read_hz);
+	write_result("SPI write clock:", 16, write_hz / 1000, "kHz", 3, 144);
+	write_result("SPI read clock:", 15, read_hz / 1000, "kHz", 3, 168);
+	transport_us = cycles_to_us(polled.transport_cycles);
+	if (transport_us == 0) transport_us = 1;
+	write_result("SDI sustained:", 14,
+			(uint32_t)((uint64_t)polled.bytes * 1000000 / transport_us),
+			"bytes/s", 7, 192);
+}
+
+/*
+ * Resets the VS1053, which loads vs1053b-patches-flac.plg, and times 32-bit
+ * writes to its memory, with batched SCI writes or one WriteSci() per word.
+ * PAR_RATE_TUNE is written with the value it already has. Returns 0 if the
+ * VS1053 didn't start.
+ */
+static uint8_t measure_sci(uint8_t batches, struct Plugin_statistics* plugin,
+		uint32_t* write_cycles) {
+	uint32_t value;
+	uint32_t start;
+	uint16_t i;
+
+	SciUseBatches(batches);
+	if (VSTestInitSoftware()) return 0;
+	GetPluginStatistics(plugin);
+
+	value = ReadVS10xxMem32(PAR_RATE_TUNE);
+	start = get_cycles();
+	for (i = 0; i < BENCHMARK_SCI_WRITES; ++i)
+		WriteVS10xxMem32(PAR_RATE_TUNE, value);
+	*write_cycles = (get_cycles() - start) / BENCHMARK_SCI_WRITES;
+	return 1;
+}
+
+/*
+ * Compares loading the FLAC patches with one WriteSci() per word, and so
+ * one chip select per word, to loading them in batched runs. It shows the
+ * words of the patches, then for each way the time loading took and the
+ * chip selects, and last the cycles a WriteVS10xxMem32() took.
+ */
+void test_sci_batches() {
+	struct Plugin_statistics single;
+	struct Plugin_statistics batched;
+	uint32_t single_cycles;
+	uint32_t batched_cycles;
+
+	Cycle_counter_Init();
+
+	if (!measure_sci(0, &single, &single_cycles) ||
+			!measure_sci(1, &batched, &batched_cycles)) {
+		SciUseBatches(1);
+		paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+		write_phraseLCD("The VS1053 didn't start.", 24, 0, 0, 0x0000, 0xFFFF);
+		return;
+	}
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	write_phraseLCD("SCI batches, loading the FLAC patches", 37, 0, 0, 0x0000, 0xFFFF);
+	write_result("Patch words:", 12, batched.words, "words", 5, 24);
+	write_result("Word by word:", 13, cycles_to_us(single.cycles), "us", 2, 48);
+	write_result("Chip selects:", 13, single.selects, "", 0, 72);
+	write_result("Batched:", 8, cycles_to_us(batched.cycles), "us", 2, 96);
+	write_result("Chip selects:", 13, batched.selects, "", 0, 120);
+	write_result("Mem32, word by word:", 20, single_cycles, "cycles", 6, 144);
+	write_result("Mem32, batched:", 15, batched_cycles, "cycles", 6, 168);
+}
+#endif /* _DISK_IMAGE */
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#ifdef _DISK_IMAGE
+#include <stdint.h>
+#else
+#include <stm32f4xx.h>
+#endif
+
+/*
+ * Area of the card used by the storage benchmarks. The reads are done on raw
+ * sectors, starting after the first megabyte to stay clear of the partition
+ * table and the FAT, which the other routines keep in their caches.
+ */
+#define BENCHMARK_FIRST_SECTOR 2048
+#define BENCHMARK_SECTORS 2048
+#define BENCHMARK_BURST_SECTORS 8
+
+/*
+ * Number of times the directory browsing replay lists the root directory,
+ * which is what the file manager does every time the list is scrolled.
+ */
+#define BENCHMARK_BROWSE_STEPS 20
+
+/*
+ * Number of random seeks timed for every file by the seek benchmark, and the
+ * smallest file it takes into account.
+ */
+#define BENCHMARK_SEEKS 100
+#define BENCHMARK_MIN_SEEK_FILE_SIZE 65536
+
+/*
+ * Storage workloads: the playback reads at most BENCHMARK_PLAYBACK_BYTES of
+ * a song, and the text is split in pages of about BENCHMARK_TEXT_PAGE_BYTES
+ * (10 lines of the text viewer), at most BENCHMARK_TEXT_PAGES of them like
+ * txt_viewer() does.
+ */
+#define BENCHMARK_PLAYBACK_BYTES 1048576
+#define BENCHMARK_TEXT_PAGE_BYTES 600
+#define BENCHMARK_TEXT_PAGES 100
+
+/*
+ * Directory filled with empty files by the sort benchmark, which sorts it
+ * with listing.c after adding files up to each of the sizes listed in
+ * benchmarks.c. The files are left on the card.
+ */
+#define BENCHMARK_SORT_DIRECTORY "/SORTBNCH"
+
+/*
+ * Prefix typed, one character at a time, into the filter of the sorted
+ * directory.
+ */
+#define BENCHMARK_FILTER "Song 01"
+
+/*
+ * Bytes of a FLAC file sent to the VS1053 by the SDI transport benchmark, once
+ * byte by byte and once by DMA.
+ */
+#define BENCHMARK_SDI_BYTES 262144
+
+/*
+ * 32-bit writes to the VS1053 memory timed by the SCI batches benchmark, once
+ * word by word and once batched.
+ */
+#define BENCHMARK_SCI_WRITES 100
+
+/*
+ * Latency model used by default on the PC: the time to send a read command
+ * and wait for the card's access time, and the time to transfer a sector
+ * (512 bytes at 12 MB/s, a 4 bits bus at 24 MHz).
+ */
+#define BENCHMARK_COMMAND_US 250
+#define BENCHMARK_SECTOR_US 43
+
+/*
+ * Reads sent to the storage by a workload, sectors read and the time they
+ * took in microseconds.
+ */
+struct Workload_result {
+	uint32_t commands;
+	uint32_t sectors;
+	uint32_t time_us;
+};
+
+/*
+ * Sort of a directory: its entries, the calls to listing_step() it took and
+ * the longest of them, the most bytes of the name arena it used and the long
+ * names that didn't fit there, besides the reads and the total time. Then
+ * the longest time taken to filter it by one more character and the entries
+ * left by the whole filter.
+ */
+struct Sort_result {
+	uint32_t entries;
+	uint32_t steps;
+	uint32_t longest_step_us;
+	uint32_t longest_filter_us;
+	uint32_t filtered;
+	uint32_t name_bytes;
+	uint32_t name_overflows;
+	struct Workload_result total;
+};
+
+void test_sd_throughput();
+void test_disk_cache();
+void test_seek_latency();
+void test_storage_workloads();
+void test_listing_sort();
+void test_catalog_indexer();
+void test_sdi_transport();
+void test_sci_batches();
+
+#endif /* BENCHMARKS_H */
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * CATALOG:
+ * The file manager only ever knows about the directory that is being shown,
+ * which is enough to browse the card, but not for anything that needs the
+ * whole library. So once the card is mounted, all its directories are
+ * crawled and every audio file found (see is_it_audio() in utils.c) is
+ * recorded in a catalog file on the card itself. On the following mounts the
+ * file is just checked and used, so even a card with thousands of songs is
+ * ready right away.
+ *
+ * Crawling a big card takes minutes, so it's never done in one go. The
+ * directories being walked are kept in an explicit stack, one DIR per level,
+ * and catalog_step() goes on from where the previous call stopped for at most
+ * CATALOG_STEP_US. The file manager and the player call it when they have
+ * nothing else to do, and it returns as soon as they tell it the screen was
+ * touched, so the user can browse and listen meanwhile.
+ *
+ * Checking that the catalog still describes the card must be cheap, so it's
+ * not compared with the directories. Instead the catalog keeps the volume
+ * serial number and the free cluster count and last allocated cluster of the
+ * FAT as they were right after it was written. Those come from the boot
+ * sector and the FSINFO sector, and almost any change made to the card on a
+ * computer changes at least one of them. On FAT12/16 there's no FSINFO, so
+ * f_getfree() has to count the free clusters and the last allocated cluster
+ * is not known at mount, so it's not compared.
+ *
+ * The entries follow the header, 16 bytes each, and are read one at a time
+ * through the sector buffer of the catalog's FIL object, which f_read() refills
+ * when an entry runs over into the next sector.
+ */
+
+#include <catalog.h>
+#include <delay.h>
+#include <utils.h>
+
+#define CATALOG_IDLE 0
+#define CATALOG_BUILDING 1
+#define CATALOG_READY 2
+#define CATALOG_FAILED 3
+
+static FIL catalog_file;
+static uint8_t state;
+static struct Catalog_header header;
+static struct Catalog_progress progress;
+
+/*
+ * Directories being crawled, one per level, and the path of each of them,
+ * which ends at path_length[level] and is needed to open its subdirectories.
+ */
+static DIR crawl_stack[CATALOG_MAX_DEPTH];
+static char path[CATALOG_MAX_DEPTH * 13 + 1];
+static uint16_t path_length[CATALOG_MAX_DEPTH];
+static int8_t level;
+
+/*
+ * Reads the values that tell if the card was changed since the catalog was
+ * written.
+ */
+static uint8_t read_volume_stamp(struct Catalog_header* stamp) {
+	FATFS* fs;
+	DWORD serial_number, free_clusters;
+
+	if (f_getlabel("", 0, &serial_number) != FR_OK) return 0;
+	if (f_getfree("", &free_clusters, &fs) != FR_OK) return 0;
+
+	stamp->serial_number = serial_number;
+	stamp->free_clusters = free_clusters;
+	stamp->last_cluster = (fs->fs_type == FS_FAT32) ? fs->last_clust : 0;
+	return 1;
+}
+
+/*
+ * Opens the catalog file and checks that it's complete and that it describes
+ * the card as it is now.
+ */
+static uint8_t load_catalog() {
+	struct Catalog_header stamp;
+	UINT bytes_read;
+
+	if (f_open(&catalog_file, CATALOG_FILE, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+		return 0;
+
+	if (f_read(&catalog_file, &header, sizeof(header), &bytes_read) == FR_OK
+			&& bytes_read == sizeof(header)
+			&& header.magic == CATALOG_MAGIC
+			&& header.version == CATALOG_VERSION
+			&& header.entry_size == sizeof(struct Catalog_entry)
+			&& f_size(&catalog_file) == sizeof(header) + header.entries * sizeof(struct Catalog_entry)
+			&& read_volume_stamp(&stamp)
+			&& stamp.serial_number == header.serial_number
+			&& stamp.free_clusters == header.free_clusters
+			&& stamp.last_cluster == header.last_cluster)
+		return 1;
+
+	f_close(&catalog_file);
+	return 0;
+}
+
+/*
+ * Creates the catalog file and starts the crawl at the root directory. The
+ * header is written with no volume stamp, so if the crawl doesn't finish the
+ * file is never taken as valid.
+ */
+static uint8_t start_catalog() {
+	UINT bytes_written;
+
+	if (f_open(&catalog_file, CATALOG_FILE, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+
+	header.magic = CATALOG_MAGIC;
+	header.version = CATALOG_VERSION;
+	header.entry_size = sizeof(struct Catalog_entry);
+	header.entries = 0;
+	header.serial_number = header.free_clusters = header.last_cluster = 0;
+
+	level = 0;
+	path_length[0] = 0;
+	if (f_write(&catalog_file, &header, sizeof(header), &bytes_written) != FR_OK
+			|| f_opendir(&crawl_stack[0], "/") != FR_OK) {
+		f_close(&catalog_file);
+		return 0;
+	}
+	progress.directories = 1;
+	return 1;
+}
+
+/*
+ * Takes the next entry of the directory on top of the stack: a directory is
+ * pushed, if it's not too deep, and an audio file is written to the catalog.
+ * The end of a directory pops it, so the crawl is over when the stack is
+ * empty. Returns 0 if the card couldn't be read or written.
+ */
+static uint8_t crawl_entry() {
+	FILINFO info;
+	struct Catalog_entry entry;
+	UINT bytes_written;
+
+	info.lfname = 0;
+	if (f_readdir(&crawl_stack[level], &info) != FR_OK) return 0;
+	if (!info.fname[0]) {
+		--level;
+		return 1;
+	}
+	++progress.entries;
+
+	if (info.fname[0] == '.') {
+		return 1;
+	}
+	else if (info.fattrib & AM_DIR) {
+		if (level + 1 < CATALOG_MAX_DEPTH) {
+			uint16_t length = path_length[level];
+			uint8_t i;
+			path[length++] = '/';
+			for (i = 0; i < 13 && info.fname[i]; ++i)
+				path[length++] = info.fname[i];
+			path[length] = 0;
+			if (f_opendir(&crawl_stack[level + 1], path) == FR_OK) {
+				++level;
+				path_length[level] = length;
+				++progress.directories;
+			}
+		}
+	}
+	else if (is_it_audio(info.fname)) {
+		entry.directory = crawl_stack[level].sclust;
+		entry.size = info.fsize;
+		entry.index = crawl_stack[level].item;
+		entry.padding = 0;
+		if (f_write(&catalog_file, &entry, sizeof(entry), &bytes_written) != FR_OK
+				|| bytes_written != sizeof(entry))
+			return 0;
+		++header.entries;
+		++progress.files;
+	}
+	return 1;
+}
+
+/*
+ * Writes the volume stamp as it is now in the header of the closed catalog
+ * file, and opens it again. That doesn't allocate anything, so the stamp
+ * stays valid.
+ */
+static uint8_t stamp_catalog() {
+	UINT bytes_written;
+	uint8_t success;
+
+	if (!read_volume_stamp(&header)) return 0;
+	if (f_open(&catalog_file, CATALOG_FILE, FA_WRITE | FA_OPEN_EXISTING) != FR_OK)
+		return 0;
+	success = f_write(&catalog_file, &header, sizeof(header), &bytes_written) == FR_OK;
+	if (f_close(&catalog_file) != FR_OK || !success) return 0;
+
+	return load_catalog();
+}
+
+/*
+ * Completes the catalog file once the crawl is over. The volume stamp can
+ * only be read once the file is complete and closed, since writing it changes
+ * the free clusters, so the header is written a second time with it.
+ */
+static uint8_t finish_catalog() {
+	UINT bytes_written;
+	uint8_t success;
+
+	success = f_lseek(&catalog_file, 0) == FR_OK
+			&& f_write(&catalog_file, &header, sizeof(header), &bytes_written) == FR_OK;
+	if (f_close(&catalog_file) != FR_OK || !success) return 0;
+
+	return stamp_catalog();
+}
+
+/*
+ * Loads the catalog of the card that has just been mounted, or starts
+ * building it if it doesn't exist or it's out of date. Returns 1 if the
+ * catalog can be used right away, otherwise catalog_step() has to be called
+ * until it's built.
+ */
+uint8_t catalog_mount() {
+	progress.directories = progress.entries = progress.files = 0;
+	progress.steps = progress.busy_us = progress.longest_step_us = 0;
+	if (load_catalog()) state = CATALOG_READY;
+	else if (start_catalog()) state = CATALOG_BUILDING;
+	else state = CATALOG_FAILED;
+	return state == CATALOG_READY;
+}
+
+/*
+ * Crawls the card for at most CATALOG_STEP_US, or less if "interrupted",
+ * which may be 0, returns other than 0. It's checked after every directory
+ * entry. Returns 1 when the catalog has just been completed.
+ */
+uint8_t catalog_step(uint8_t (*interrupted)()) {
+	uint32_t start, elapsed;
+
+	if (state != CATALOG_BUILDING) return 0;
+	start = get_cycles();
+	do {
+		if (!crawl_entry()) {
+			f_close(&catalog_file);
+			state = CATALOG_FAILED;
+			return 0;
+		}
+		elapsed = cycles_to_us(get_cycles() - start);
+	} while (level >= 0 && elapsed < CATALOG_STEP_US
+			&& !(interrupted && interrupted()));
+
+	++progress.steps;
+	progress.busy_us += elapsed;
+	if (elapsed > progress.longest_step_us) progress.longest_step_us = elapsed;
+	if (level >= 0) return 0;
+
+	state = finish_catalog() ? CATALOG_READY : CATALOG_FAILED;
+	return state == CATALOG_READY;
+}
+
+/*
+ * Tells if the catalog is being built, that is, if catalog_step() has to be
+ * called.
+ */
+uint8_t catalog_busy() {
+	return state == CATALOG_BUILDING;
+}
+
+uint8_t catalog_ready() {
+	return state == CATALOG_READY;
+}
+
+/*
+ * The firmware's own writes to the card, like the spill files listing.c
+ * sorts big directories with, change the volume stamp as well, and the
+ * catalog would be built again at the next mount. So once they're closed
+ * the stamp of a ready catalog is brought up to date. While the catalog is
+ * being built there's nothing to do, it's stamped when it's finished.
+ */
+void catalog_restamp() {
+	struct Catalog_header stamp;
+
+	if (state != CATALOG_READY || !read_volume_stamp(&stamp)) return;
+	if (stamp.serial_number == header.serial_number
+			&& stamp.free_clusters == header.free_clusters
+			&& stamp.last_cluster == header.last_cluster)
+		return;
+
+	f_close(&catalog_file);
+	if (!stamp_catalog()) state = CATALOG_FAILED;
+}
+
+/*
+ * Gets the progress of the crawl that builds the catalog, or that built it
+ * if it's finished. Everything is 0 if the catalog was just loaded.
+ */
+void catalog_get_progress(struct Catalog_progress* catalog_progress) {
+	*catalog_progress = progress;
+	catalog_progress->entries_per_second = progress.busy_us ?
+			(uint32_t)((uint64_t)progress.entries * 1000000 / progress.busy_us) : 0;
+}
+
+/*
+ * Audio files in the catalog, 0 until it's ready.
+ */
+uint32_t catalog_entries() {
+	return (state == CATALOG_READY) ? header.entries : 0;
+}
+
+/*
+ * Reads an entry of the catalog, numbered from 0.
+ */
+uint8_t catalog_get(uint32_t number, struct Catalog_entry* entry) {
+	UINT bytes_read;
+
+	if (state != CATALOG_READY || number >= header.entries) return 0;
+	if (f_lseek(&catalog_file, sizeof(header) + number * sizeof(struct Catalog_entry)) != FR_OK)
+		return 0;
+	return f_read(&catalog_file, entry, sizeof(struct Catalog_entry), &bytes_read) == FR_OK
+			&& bytes_read == sizeof(struct Catalog_entry);
+}
+
+/*
+ * Reads the directory entry of a file of the catalog, which gives its 8.3
+ * name. The entry is read on its own, so there's never a long name, but
+ * info->lfname must still be set (to 0 or with names_attach()).
+ */
+uint8_t catalog_get_info(uint32_t number, FILINFO* info) {
+	struct Catalog_entry entry;
+	DIR directory;
+
+	if (!catalog_get(number, &entry)) return 0;
+	if (f_opencluster(&directory, entry.directory) != FR_OK) return 0;
+	if (f_seekdir(&directory, entry.index) != FR_OK) return 0;
+	return f_readdir(&directory, info) == FR_OK && info->fname[0];
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stm32f4xx.h>
+#include <ff.h>
+
+/*
+ * The catalog file, in the root directory of the card, and the deepest level
+ * of directories that is crawled when it's built.
+ */
+#define CATALOG_FILE "/CATALOG.DAT"
+#define CATALOG_MAGIC 0x4C544143
+#define CATALOG_VERSION 1
+#define CATALOG_MAX_DEPTH 8
+
+/*
+ * Longest time, in us, that catalog_step() keeps crawling the card.
+ */
+#define CATALOG_STEP_US 2000
+
+/*
+ * The catalog file starts with this header. The last three fields describe
+ * the volume as it was when the catalog was written; if any of them is
+ * different at mount the card was changed elsewhere and the catalog is
+ * built again.
+ */
+struct Catalog_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entry_size;
+	uint32_t entries;
+	uint32_t serial_number;
+	uint32_t free_clusters;
+	uint32_t last_cluster;
+};
+
+/*
+ * One audio file: the start cluster of its directory (0 for the root), the
+ * index of its entry in that directory (DIR.item) and its size.
+ */
+struct Catalog_entry {
+	uint32_t directory;
+	uint32_t size;
+	uint16_t index;
+	uint16_t padding;
+};
+
+/*
+ * How the crawl that builds the catalog is going: the directories opened, the
+ * entries read from them and the audio files found, the calls to
+ * catalog_step() that did some work, the time they took in total and the
+ * longest of them. The throughput is in directory entries per second.
+ */
+struct Catalog_progress {
+	uint32_t directories;
+	uint32_t entries;
+	uint32_t files;
+	uint32_t steps;
+	uint32_t busy_us;
+	uint32_t longest_step_us;
+	uint32_t entries_per_second;
+};
+
+uint8_t catalog_mount();
+uint8_t catalog_step(uint8_t (*interrupted)());
+uint8_t catalog_busy();
+uint8_t catalog_ready();
+void catalog_restamp();
+void catalog_get_progress(struct Catalog_progress* catalog_progress);
+uint32_t catalog_entries();
+uint8_t catalog_get(uint32_t number, struct Catalog_entry* entry);
+uint8_t catalog_get_info(uint32_t number, FILINFO* info);
+
+#endif /* CATALOG_H */
@@ -175,3 +175,20 @@ void Timers_Init() {
 	TIM_Cmd(TIM3, ENABLE);
 	TIM_Cmd(TIM4, ENABLE);
 }
+
+/*
+ * Timers are fine for delays, but they are too coarse (and too short, being
+ * 16 bits) to measure how long a piece of code takes. For that the Cortex-M4
+ * core has a 32 bit cycle counter in its DWT (Data Watchpoint and Trace) unit
+ * which increases with every CPU clock cycle, so at 168 Mhz it overflows only
+ * after about 25 seconds. It's disabled by default and the whole trace block
+ * has to be enabled first in the debug control register.
+ *
+ * Unsigned subtraction of two get_cycles() readings gives the right elapsed
+ * count even if the counter wrapped around once in between.
+ */
+void Cycle_counter_Init() {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
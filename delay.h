@@ -34,8 +34,13 @@
 
 #define Delay_1inst() asm("nop")
 
+#define CPU_FREQUENCY_MHZ 168
+#define get_cycles() (DWT->CYCCNT)
+#define cycles_to_us(cycles) ((cycles) / CPU_FREQUENCY_MHZ)
+
 void Delay_ms(uint16_t value);
 void Delay_us(uint16_t value);
 void Timers_Init();
+void Cycle_counter_Init();
 
 #endif /* DELAY_H */
@@ -604,6 +604,26 @@ uint16_t write_phraseLCD(char *phrase, uint16_t phrase_length, uint16_t x, uint1
 	return x - 1;
 }
 
+/*
+ * Same as write_phraseLCD(), but the phrase is cut before the first character
+ * that would go past the column x_limit. It's meant for text of unknown
+ * length, like long file names, that must not cover what is next to it.
+ */
+uint16_t write_phrase_limitedLCD(char *phrase, uint16_t phrase_length,
+					uint16_t x, uint16_t y, uint16_t x_limit,
+					uint16_t letter_color, uint16_t background_color) {
+	uint16_t i;
+
+	for (i = 0; i < phrase_length && phrase[i] >= 32; ++i) {
+		if (x + get_letter_length(phrase[i]) - 1 > x_limit) break;
+		x = write_letterLCD(phrase[i], x, y, letter_color, background_color);
+		++x;
+	}
+
+	if (!i) return x;
+	return x - 1;
+}
+
 /*
  * A function to write a number stored as an array of ASCII characters. It will
  * not write zero digits, which will be stored as first digits in any numbers
@@ -50,6 +50,9 @@ uint16_t write_letterLCD(char letter, uint16_t x, uint16_t y,
 				uint16_t letter_color, uint16_t background_color);
 uint16_t write_phraseLCD(char *phrase, uint16_t phrase_length, uint16_t x, uint16_t y,
 					uint16_t letter_color, uint16_t background_color);
+uint16_t write_phrase_limitedLCD(char *phrase, uint16_t phrase_length,
+					uint16_t x, uint16_t y, uint16_t x_limit,
+					uint16_t letter_color, uint16_t background_color);
 uint16_t write_numberLCD(char* number, uint16_t number_length, uint16_t x, uint16_t y,
 					uint16_t number_color, uint16_t backgound_color);
 void paint_imageLCD(uint16_t *image, uint16_t x, uint16_t y);
@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * LISTING:
+ * FAT keeps the entries of a directory in the order they were written, which
+ * for a folder copied from a computer is rarely the order anybody expects.
+ * This module sorts the directory shown by the file manager: directories
+ * first, then files, both by name ignoring the case. The long name is used
+ * when there is one, and kept in the name arena of names.c, which is emptied
+ * when the next directory is sorted. Every entry is kept as a 16 bytes
+ * record, so a sector holds 32 of them.
+ *
+ * The sort never blocks for long. listing_open() only opens the directory,
+ * and then every call to listing_step() reads LISTING_STEP_ENTRIES entries and
+ * inserts them, with a binary search, in the sorted run kept in RAM. If the
+ * directory has more than LISTING_RAM_RECORDS entries, every full run is
+ * written to a spill file on the card and, once the directory was read, the
+ * runs are merged two by two between the two spill files, LISTING_STEP_RECORDS
+ * records per step, until one sorted run is left. The records are then read
+ * from that file. The spill files have the system attribute, so they're
+ * skipped like any other system entry.
+ *
+ * While merging, the RAM run is free, so its first sectors are used as the
+ * buffers of the two runs being merged and of the output.
+ *
+ * Once sorted, the directory can be filtered by the beginning of the names.
+ * As the entries are sorted, the directories and the files that match a
+ * prefix are two contiguous ranges, found with binary searches. Every
+ * character added searches only inside the ranges of the previous prefix, and
+ * the ranges of every shorter prefix are kept, so removing a character costs
+ * nothing. Even for a directory of thousands of entries sorted on the card
+ * that's a few dozens of records read per character.
+ *
+ * While the entries are read, they are also counted by the first character
+ * of their names. When the sort is finished, the counts become the position
+ * of the first entry of every letter, so jumping to a letter doesn't read
+ * anything.
+ */
+
+#include <listing.h>
+#include <names.h>
+
+#define LISTING_IDLE 0
+#define LISTING_READING 1
+#define LISTING_MERGING 2
+#define LISTING_READY 3
+#define LISTING_FAILED 4
+
+#define RECORDS_PER_SECTOR (512 / sizeof(struct Listing_record))
+
+/*
+ * One of the two runs being merged: the buffer of records read from it and
+ * the part of the source file that hasn't been read yet.
+ */
+struct Merge_input {
+	FIL file;
+	struct Listing_record* buffer;
+	uint32_t next;
+	uint32_t end;
+	uint8_t position;
+	uint8_t fill;
+};
+
+static struct Listing_record records[LISTING_RAM_RECORDS] __attribute__ ((aligned (4)));
+static uint8_t state = LISTING_IDLE;
+static DIR directory;
+static uint16_t entries;
+
+//Records in the run kept in RAM, and runs already written to the card.
+static uint16_t run_records;
+static uint16_t runs;
+
+//Merge state: spill file read (0 is LISTING_SPILL_A), length of its runs and
+//first record of the pair of runs being merged.
+static uint8_t source;
+static uint32_t run_length;
+static uint32_t pair_start;
+static struct Merge_input inputs[2];
+static FIL output;
+static uint8_t output_fill;
+
+//Directories at the beginning of the sorted records.
+static uint16_t directories;
+
+/*
+ * Directories and files whose names begin with each group of characters
+ * while the directory is read, and the position of the first of them once
+ * it's sorted.
+ */
+static uint16_t letters[2][LISTING_LETTER_GROUPS];
+
+/*
+ * Entries that match a prefix: the range of directories and the range of
+ * files, as the first record and the one after the last.
+ */
+struct Filter_ranges {
+	uint16_t first[2];
+	uint16_t end[2];
+};
+
+//Prefix being filtered by and ranges for every length of it, up to the whole.
+static char filter[LISTING_FILTER_LENGTH];
+static uint8_t filter_length;
+static struct Filter_ranges filter_ranges[LISTING_FILTER_LENGTH + 1];
+
+/*
+ * Gets the name a record is sorted by, which is the long one if it was kept,
+ * and the most characters it can have.
+ */
+static const char* sort_name(const struct Listing_record* record,
+		uint16_t* length) {
+	const char* name = names_get(record->long_name);
+	if (name) {
+		*length = _MAX_LFN;
+		return name;
+	}
+	*length = sizeof(record->name);
+	return record->name;
+}
+
+static uint8_t fold_case(uint8_t letter) {
+	if (letter >= 'a' && letter <= 'z') return letter - ('a' - 'A');
+	return letter;
+}
+
+/*
+ * Gets the group of a record among the LISTING_LETTER_GROUPS, by the first
+ * character of the name it's sorted by.
+ */
+static uint8_t letter_group(const struct Listing_record* record) {
+	uint16_t length;
+	uint8_t letter = fold_case(sort_name(record, &length)[0]);
+	if (letter < 'A') return 0;
+	if (letter > 'Z') return LISTING_LETTER_GROUPS - 1;
+	return letter - 'A' + 1;
+}
+
+/*
+ * Compares two records: directories go before files and names are compared
+ * without caring about the case.
+ */
+static int8_t compare_records(const struct Listing_record* a,
+		const struct Listing_record* b) {
+	const char* name_a;
+	const char* name_b;
+	uint16_t length_a, length_b, i;
+
+	if ((a->attrib & AM_DIR) != (b->attrib & AM_DIR))
+		return (a->attrib & AM_DIR) ? -1 : 1;
+	name_a = sort_name(a, &length_a);
+	name_b = sort_name(b, &length_b);
+	for (i = 0; ; ++i) {
+		uint8_t x = fold_case((i < length_a) ? name_a[i] : 0);
+		uint8_t y = fold_case((i < length_b) ? name_b[i] : 0);
+		if (x != y) return (x < y) ? -1 : 1;
+		if (!x) break;
+	}
+	return 0;
+}
+
+/*
+ * Compares the beginning of the name of a record with the first "length"
+ * characters of the filter, the same way compare_records() does.
+ */
+static int8_t compare_prefix(const struct Listing_record* record,
+		uint8_t length) {
+	uint16_t name_length, i;
+	const char* name = sort_name(record, &name_length);
+
+	for (i = 0; i < length; ++i) {
+		uint8_t x = fold_case((i < name_length) ? name[i] : 0);
+		uint8_t y = fold_case(filter[i]);
+		if (x != y) return (x < y) ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * Inserts a record in the run kept in RAM, after any equal record so the
+ * order of the directory is kept for them.
+ */
+static void insert_record(const struct Listing_record* record) {
+	uint16_t low = 0;
+	uint16_t high = run_records;
+	uint16_t i;
+
+	while (low < high) {
+		uint16_t middle = (low + high) / 2;
+		if (compare_records(&records[middle], record) <= 0) low = middle + 1;
+		else high = middle;
+	}
+	for (i = run_records; i > low; --i) records[i] = records[i - 1];
+	records[low] = *record;
+	++run_records;
+}
+
+static const TCHAR* spill_file(uint8_t number) {
+	return number ? LISTING_SPILL_B : LISTING_SPILL_A;
+}
+
+/*
+ * Creates a spill file, or empties it, and marks it as a system file.
+ */
+static uint8_t create_spill_file(FIL* file, uint8_t number) {
+	if (f_open(file, spill_file(number), FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+		return 0;
+	f_chmod(spill_file(number), AM_SYS | AM_HID, AM_SYS | AM_HID);
+	return 1;
+}
+
+static uint8_t write_records(FIL* file, struct Listing_record* buffer,
+		uint16_t count) {
+	UINT bytes_written;
+	UINT bytes = count * sizeof(struct Listing_record);
+	return f_write(file, buffer, bytes, &bytes_written) == FR_OK
+			&& bytes_written == bytes;
+}
+
+/*
+ * Closes every spill file and gives up, the file manager will show the
+ * directory as it is.
+ */
+static uint8_t fail() {
+	f_close(&inputs[0].file);
+	f_close(&inputs[1].file);
+	f_close(&output);
+	state = LISTING_FAILED;
+	return 0;
+}
+
+/*
+ * Writes the run kept in RAM at the end of the first spill file.
+ */
+static uint8_t spill_run() {
+	if (!runs && !create_spill_file(&output, 0)) return 0;
+	if (!write_records(&output, records, run_records)) return 0;
+	++runs;
+	run_records = 0;
+	return 1;
+}
+
+/*
+ * Prepares the inputs to merge the pair of runs that starts at pair_start.
+ */
+static uint8_t start_pair() {
+	uint8_t i;
+	uint32_t next = pair_start;
+
+	for (i = 0; i < 2; ++i) {
+		inputs[i].next = next;
+		inputs[i].end = next + run_length;
+		if (inputs[i].end > entries) inputs[i].end = entries;
+		inputs[i].position = 0;
+		inputs[i].fill = 0;
+		if (f_lseek(&inputs[i].file, next * sizeof(struct Listing_record)) != FR_OK)
+			return 0;
+		next = inputs[i].end;
+	}
+	return 1;
+}
+
+/*
+ * Reads a record of the sorted directory, from RAM or from the card.
+ */
+static uint8_t read_record(uint16_t number, struct Listing_record* record) {
+	UINT bytes_read;
+
+	if (!runs) {
+		*record = records[number];
+		return 1;
+	}
+	if (f_lseek(&inputs[0].file, (DWORD)number * sizeof(struct Listing_record)) != FR_OK
+			|| f_read(&inputs[0].file, record, sizeof(struct Listing_record),
+					&bytes_read) != FR_OK
+			|| bytes_read != sizeof(struct Listing_record))
+		return 0;
+	return 1;
+}
+
+/*
+ * Finds, between "first" and "end", the first record whose beginning is
+ * greater than the first "length" characters of the filter or, if "equal" is
+ * set, greater or equal to them. A record that can't be read ends the search
+ * there.
+ */
+static uint16_t search_prefix(uint16_t first, uint16_t end, uint8_t length,
+		uint8_t equal) {
+	struct Listing_record record;
+
+	while (first < end) {
+		uint16_t middle = first + (end - first) / 2;
+		int8_t comparison;
+		if (!read_record(middle, &record)) return middle;
+		comparison = compare_prefix(&record, length);
+		if (comparison < 0 || (comparison == 0 && !equal)) first = middle + 1;
+		else end = middle;
+	}
+	return first;
+}
+
+/*
+ * Finds the ranges for the first "length" characters of the filter inside
+ * the ranges of the prefix one character shorter.
+ */
+static void narrow_filter(uint8_t length) {
+	struct Filter_ranges* previous = &filter_ranges[length - 1];
+	struct Filter_ranges* ranges = &filter_ranges[length];
+	uint8_t i;
+
+	for (i = 0; i < 2; ++i) {
+		ranges->first[i] = search_prefix(previous->first[i], previous->end[i],
+				length, 1);
+		ranges->end[i] = search_prefix(ranges->first[i], previous->end[i],
+				length, 0);
+	}
+}
+
+/*
+ * Marks the directory as sorted and applies the filter, which may have been
+ * typed while it was being sorted.
+ */
+static void finish_sort() {
+	uint16_t position[2] = {0, directories};
+	uint8_t length, i, j;
+
+	for (i = 0; i < 2; ++i) {
+		for (j = 0; j < LISTING_LETTER_GROUPS; ++j) {
+			uint16_t count = letters[i][j];
+			letters[i][j] = position[i];
+			position[i] += count;
+		}
+	}
+	state = LISTING_READY;
+	filter_ranges[0].first[0] = 0;
+	filter_ranges[0].end[0] = directories;
+	filter_ranges[0].first[1] = directories;
+	filter_ranges[0].end[1] = entries;
+	for (length = 1; length <= filter_length; ++length) narrow_filter(length);
+}
+
+/*
+ * Starts a merge pass, or finishes the sort if the source file holds a
+ * single run. The sorted records are then read through inputs[0].
+ */
+static uint8_t start_pass() {
+	if (run_length >= entries) {
+		if (f_open(&inputs[0].file, spill_file(source), FA_READ | FA_OPEN_EXISTING) != FR_OK)
+			return 0;
+		finish_sort();
+		return 1;
+	}
+	if (f_open(&inputs[0].file, spill_file(source), FA_READ | FA_OPEN_EXISTING) != FR_OK
+			|| f_open(&inputs[1].file, spill_file(source), FA_READ | FA_OPEN_EXISTING) != FR_OK
+			|| !create_spill_file(&output, source ^ 1))
+		return 0;
+	inputs[0].buffer = records;
+	inputs[1].buffer = records + RECORDS_PER_SECTOR;
+	output_fill = 0;
+	pair_start = 0;
+	state = LISTING_MERGING;
+	return start_pair();
+}
+
+/*
+ * Called once the whole directory was read. If it fit in RAM it's already
+ * sorted, else the last run is written and the merge begins.
+ */
+static uint8_t finish_reading() {
+	if (!runs) {
+		finish_sort();
+		return 1;
+	}
+	if (run_records && !spill_run()) return fail();
+	if (f_close(&output) != FR_OK) return fail();
+	source = 0;
+	run_length = LISTING_RAM_RECORDS;
+	if (!start_pass()) return fail();
+	return state == LISTING_READY;
+}
+
+/*
+ * Makes sure the buffer of an input holds its next record. Returns 0 if the
+ * run was fully merged, or if it couldn't be read, which sets "error".
+ */
+static uint8_t peek_input(struct Merge_input* input, uint8_t* error) {
+	if (input->position == input->fill) {
+		UINT bytes_read;
+		uint32_t count = input->end - input->next;
+		if (!count) return 0;
+		if (count > RECORDS_PER_SECTOR) count = RECORDS_PER_SECTOR;
+		if (f_read(&input->file, input->buffer, count * sizeof(struct Listing_record),
+				&bytes_read) != FR_OK
+				|| bytes_read != count * sizeof(struct Listing_record)) {
+			*error = 1;
+			return 0;
+		}
+		input->next += count;
+		input->fill = count;
+		input->position = 0;
+	}
+	return 1;
+}
+
+/*
+ * Merges up to LISTING_STEP_RECORDS records, moving to the next pair of runs
+ * and to the next pass when needed.
+ */
+static uint8_t merge_step() {
+	struct Listing_record* out = records + 2 * RECORDS_PER_SECTOR;
+	uint16_t count;
+	uint8_t error = 0;
+
+	for (count = 0; count < LISTING_STEP_RECORDS; ++count) {
+		uint8_t a = peek_input(&inputs[0], &error);
+		uint8_t b = peek_input(&inputs[1], &error);
+		struct Merge_input* input;
+
+		if (error) return fail();
+		if (!a && !b) {
+			pair_start += 2 * run_length;
+			if (pair_start < entries) {
+				if (!start_pair()) return fail();
+				continue;
+			}
+			//The pass is over, the output becomes the source of the next one.
+			if (output_fill && !write_records(&output, out, output_fill))
+				return fail();
+			if (f_close(&output) != FR_OK) return fail();
+			f_close(&inputs[0].file);
+			f_close(&inputs[1].file);
+			source ^= 1;
+			run_length *= 2;
+			if (!start_pass()) return fail();
+			return state == LISTING_READY;
+		}
+
+		if (a && (!b || compare_records(&inputs[0].buffer[inputs[0].position],
+				&inputs[1].buffer[inputs[1].position]) <= 0))
+			input = &inputs[0];
+		else
+			input = &inputs[1];
+		out[output_fill++] = input->buffer[input->position++];
+		if (output_fill == RECORDS_PER_SECTOR) {
+			if (!write_records(&output, out, output_fill)) return fail();
+			output_fill = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Forgets the sorted directory, so the next listing_open() sorts it again
+ * even if it's the same one.
+ */
+void listing_close() {
+	fail();
+	state = LISTING_IDLE;
+}
+
+/*
+ * Starts sorting a directory. Nothing is done if that directory is the one
+ * already sorted, or being sorted.
+ */
+void listing_open(const TCHAR* path) {
+	DIR opened;
+	uint8_t i;
+
+	if (f_opendir(&opened, path) != FR_OK) {
+		fail();
+		return;
+	}
+	if (state != LISTING_IDLE && opened.id == directory.id
+			&& opened.sclust == directory.sclust)
+		return;
+
+	fail();
+	directory = opened;
+	entries = 0;
+	directories = 0;
+	run_records = 0;
+	runs = 0;
+	filter_length = 0;
+	for (i = 0; i < LISTING_LETTER_GROUPS; ++i) letters[0][i] = letters[1][i] = 0;
+	names_reset();
+	state = LISTING_READING;
+}
+
+/*
+ * Does the next slice of the sort. Returns 1 when the sort has just been
+ * finished, so the caller knows the listing has to be shown again.
+ */
+uint8_t listing_step() {
+	FILINFO info;
+	struct Listing_record record;
+	uint16_t count;
+	uint8_t i;
+
+	if (state == LISTING_MERGING) return merge_step();
+	if (state != LISTING_READING) return 0;
+
+	names_attach(&info);
+	record.padding = 0;
+	for (count = 0; count < LISTING_STEP_ENTRIES; ++count) {
+		if (f_readdir(&directory, &info) != FR_OK) return fail();
+		if (!info.fname[0] || entries == 0xFFFF) return finish_reading();
+		if (info.fname[0] == '.' || (info.fattrib & AM_SYS)) continue;
+
+		if (run_records == LISTING_RAM_RECORDS && !spill_run()) return fail();
+		for (i = 0; i < sizeof(record.name) && info.fname[i]; ++i)
+			record.name[i] = info.fname[i];
+		while (i < sizeof(record.name)) record.name[i++] = 0;
+		record.attrib = info.fattrib;
+		record.long_name = info.lfname[0] ? names_keep(info.lfname) : NAMES_NONE;
+		insert_record(&record);
+		++entries;
+		if (record.attrib & AM_DIR) ++directories;
+		++letters[(record.attrib & AM_DIR) ? 0 : 1][letter_group(&record)];
+	}
+	return 0;
+}
+
+/*
+ * Tells if the sort is still going on, that is, if listing_step() has to be
+ * called.
+ */
+uint8_t listing_busy() {
+	return state == LISTING_READING || state == LISTING_MERGING;
+}
+
+uint8_t listing_ready() {
+	return state == LISTING_READY;
+}
+
+uint16_t listing_entries() {
+	return entries;
+}
+
+/*
+ * Gets the record at the specified position of the sorted directory.
+ */
+uint8_t listing_get(uint16_t number, struct Listing_record* record) {
+	if (state != LISTING_READY || number >= entries) return 0;
+	return read_record(number, record);
+}
+
+/*
+ * Gets the position of the first file whose name begins with the letter, or
+ * with a later one. If there are no files, the directories are looked at. It
+ * takes no time, the positions were found while sorting.
+ */
+uint16_t listing_letter_position(char letter) {
+	uint8_t group = (letter >= 'A' && letter <= 'Z') ? letter - 'A' + 1 : 0;
+	if (state != LISTING_READY) return 0;
+	return letters[(entries > directories) ? 1 : 0][group];
+}
+
+/*
+ * Adds a character to the filter. Returns 0 if the filter is already as long
+ * as it can be. The filter is kept until another directory is opened.
+ */
+uint8_t listing_filter_add(char letter) {
+	if (filter_length == LISTING_FILTER_LENGTH) return 0;
+	filter[filter_length++] = letter;
+	if (state == LISTING_READY) narrow_filter(filter_length);
+	return 1;
+}
+
+void listing_filter_remove() {
+	if (filter_length) --filter_length;
+}
+
+void listing_filter_clear() {
+	filter_length = 0;
+}
+
+uint8_t listing_filter_length() {
+	return filter_length;
+}
+
+/*
+ * The filter, which is not terminated, see listing_filter_length().
+ */
+const char* listing_filter_text() {
+	return filter;
+}
+
+/*
+ * Entries of the sorted directory that match the filter, all of them if it's
+ * empty.
+ */
+uint16_t listing_filtered_entries() {
+	struct Filter_ranges* ranges = &filter_ranges[filter_length];
+	if (state != LISTING_READY) return 0;
+	return (ranges->end[0] - ranges->first[0]) + (ranges->end[1] - ranges->first[1]);
+}
+
+/*
+ * Gets the record at the specified position among the entries that match the
+ * filter.
+ */
+uint8_t listing_filtered_get(uint16_t number, struct Listing_record* record) {
+	struct Filter_ranges* ranges = &filter_ranges[filter_length];
+	uint16_t matching_directories = ranges->end[0] - ranges->first[0];
+
+	if (state != LISTING_READY || number >= listing_filtered_entries()) return 0;
+	if (number < matching_directories)
+		return read_record(ranges->first[0] + number, record);
+	return read_record(ranges->first[1] + number - matching_directories, record);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#ifdef _DISK_IMAGE
+#include <stdint.h>
+#else
+#include <stm32f4xx.h>
+#endif
+#include <ff.h>
+
+/*
+ * Number of entries sorted in RAM. A directory with more entries is sorted
+ * in runs of this size that are merged on the card, in the two spill files.
+ */
+#define LISTING_RAM_RECORDS 512
+#define LISTING_SPILL_A "/SORT0.TMP"
+#define LISTING_SPILL_B "/SORT1.TMP"
+
+/*
+ * Work done by every call to listing_step(): the directory entries read and
+ * inserted in the current run, or the records merged.
+ */
+#define LISTING_STEP_ENTRIES 16
+#define LISTING_STEP_RECORDS 128
+
+/*
+ * Longest prefix the sorted directory can be filtered by.
+ */
+#define LISTING_FILTER_LENGTH 16
+
+/*
+ * Groups of entries by the first character of their names, as they are
+ * sorted: anything before 'A', each letter and anything after 'Z'.
+ */
+#define LISTING_LETTER_GROUPS 28
+
+/*
+ * One entry of a sorted directory: its 8.3 name, padded with zeros, its
+ * attributes and the offset of its long name in the name arena (see names.c),
+ * which is NAMES_NONE if it has none or it didn't fit.
+ */
+struct Listing_record {
+	char name[12];
+	BYTE attrib;
+	BYTE padding;
+	WORD long_name;
+};
+
+void listing_open(const TCHAR* path);
+void listing_close();
+uint8_t listing_step();
+uint8_t listing_busy();
+uint8_t listing_ready();
+uint16_t listing_entries();
+uint8_t listing_get(uint16_t number, struct Listing_record* record);
+uint8_t listing_filter_add(char letter);
+void listing_filter_remove();
+void listing_filter_clear();
+uint8_t listing_filter_length();
+const char* listing_filter_text();
+uint16_t listing_filtered_entries();
+uint8_t listing_filtered_get(uint16_t number, struct Listing_record* record);
+uint16_t listing_letter_position(char letter);
+
+#endif /* LISTING_H */
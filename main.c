@@ -63,15 +63,19 @@
 #include <stm324xg_eval_sdio_sd.h>
 #include <vs10xx_uc.h>
 #include <player.h>
+#include <benchmarks.h>
+#include <catalog.h>
+#include <navigation.h>
+#include <probe.h>
+#include <tags.h>
+#include <playlist.h>
 
 #define NO_SDCARD 0
 #define OPEN_FILE 1
+#define PLAY_TREE 2
 
 char current_directory_path[20];
-char visited_directories[50][13];
 char target_file[13];
-uint16_t cursors[50];
-uint8_t depth;
 uint8_t volume;
 uint8_t volume_step;
 uint8_t mute;
@@ -81,6 +85,8 @@ int main(void)
 	GPIOLED_Init();
 	GPIOLCD_Init();
 	Timers_Init();
+	//The catalog's time slices and the SCI/SD timings count CPU cycles.
+	Cycle_counter_Init();
 	LCD_Init();
 
 	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
@@ -99,12 +105,14 @@ int main(void)
 
 	uint8_t init = 0;
 
-	current_directory_path[0] = '/';
+	/*
+	 * The directory shown by the file manager is always FatFs' current
+	 * directory, which the navigation stack keeps up to date, so it's just
+	 * referred to as ".".
+	 */
+	current_directory_path[0] = '.';
 	current_directory_path[1] = 0;
-	visited_directories[0][0] = '/';
-	visited_directories[0][1] = 0;
-	cursors[0] = 0;
-	depth = 0;
+	navigation_reset();
 
 	//Initialize audio codec VS1053
 	GPIOVS1053_Init();
@@ -129,6 +137,14 @@ int main(void)
 	//test_touch_values();
 	//simple_drawing();
 	//test_touch_boxes();
+	//test_sd_throughput();
+	//test_disk_cache();
+	//test_seek_latency();
+	//test_storage_workloads();
+	//test_listing_sort();
+	//test_catalog_indexer();
+	//test_sdi_transport();
+	//test_sci_batches();
 
     while(1)
     {
@@ -148,6 +164,11 @@ int main(void)
     			result = f_mount(&file_system, "0:", 1);
 
     			if (result == FR_OK) {
+    				paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+    				write_phraseLCD("Reading the music catalog...", 28, 0, 0, 0x0000, 0xFFFF);
+    				catalog_mount();
+    				probe_reset();
+    				tags_reset();
     				paint_areaLCD(0, 0, 479, 271, 0xFFFF);
     				while (SDCard_present()) {
     					uint8_t command = file_manager();
@@ -156,8 +177,19 @@ int main(void)
     							command = txt_viewer();
     							if (command > 0) system_message(command);
     						}
+    						else if (playlist_is_it(target_file)) {
+    							int success = VSTestPlayList(target_file);
+    							if (success == -1) system_message(0);
+    						}
     						else {
-    							if (is_it_audio(target_file)) {
+    							/*
+    							 * A file the probe doesn't recognize, like an MP3
+    							 * with junk before its first frame, is still
+    							 * played from its beginning if its extension is
+    							 * that of an audio file.
+    							 */
+    							struct Media_info media;
+    							if (probe_path(target_file, &media) || is_it_audio(target_file)) {
     								int success = VSTestHandleFile(target_file, 0);
     								if (success == -1) system_message(5);
     							}
@@ -166,6 +198,10 @@ int main(void)
     							}
     						}
     					}
+    					else if (command == PLAY_TREE) {
+    						int success = VSTestPlayTree(target_file);
+    						if (success == -1) system_message(0);
+    					}
     				}
     			}
     			else {
@@ -179,8 +215,7 @@ int main(void)
     	else {
     		if (init) {
     			init = 0;
-    			depth = 0;
-    			cursors[0] = 0;
+    			navigation_reset();
     			paint_areaLCD(0, 0, 479, 271, 0xFFFF);
     			write_phraseLCD("SDCard absent.", 14, 0, 0, 0x0000, 0xFFFF);
     		}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * NAMES:
+ * With long file names enabled, f_readdir() can return a name of up to
+ * _MAX_LFN characters besides the 8.3 one, but reserving that much for every
+ * entry that is listed or cached would take far more RAM than the names
+ * really need. So there is only one buffer where f_readdir() writes the long
+ * name (see names_attach()), and the names worth keeping are copied, just as
+ * long as they are, to an arena that is emptied at once when another
+ * directory is opened.
+ *
+ * The arena is filled from both ends. The names kept for the sorted listing
+ * (see listing.c) grow from the beginning and stay until the directory
+ * changes. The names of the entries on screen while the directory is not
+ * sorted yet grow from the end and are dropped every time the screen is
+ * drawn again. When both meet, a name isn't kept and the 8.3 name is used
+ * instead. The high water marks tell how big the arena should be for the
+ * directories on a card.
+ */
+
+#include <names.h>
+
+static char arena[NAMES_ARENA_SIZE];
+static char long_name[_MAX_LFN + 1];
+static uint16_t bottom;
+static uint16_t top = NAMES_ARENA_SIZE;
+static struct Names_stats stats;
+
+/*
+ * Makes f_readdir() write the long name of the entries it reads to the shared
+ * buffer, where it stays until the next entry is read. The buffer is empty
+ * if the entry has no long name.
+ */
+void names_attach(FILINFO* info) {
+	info->lfname = long_name;
+	info->lfsize = sizeof(long_name);
+}
+
+static void update_high_water() {
+	uint16_t used = bottom + (NAMES_ARENA_SIZE - top);
+	if (used > stats.high_water) stats.high_water = used;
+	if (used > stats.directory_high_water) stats.directory_high_water = used;
+}
+
+static uint16_t name_size(const TCHAR* name) {
+	uint16_t length = 0;
+	while (name[length]) ++length;
+	return length + 1;
+}
+
+/*
+ * Tells if "size" bytes are still free between both ends of the arena, and
+ * counts the name as an overflow if they aren't.
+ */
+static uint8_t name_fits(uint16_t size) {
+	if (size > top - bottom) {
+		++stats.overflows;
+		return 0;
+	}
+	return 1;
+}
+
+static void copy_name(const TCHAR* name, uint16_t offset, uint16_t size) {
+	uint16_t i;
+	for (i = 0; i < size; ++i) arena[offset + i] = name[i];
+}
+
+/*
+ * Drops every name, to be called when another directory is opened.
+ */
+void names_reset() {
+	bottom = 0;
+	top = NAMES_ARENA_SIZE;
+	stats.directory_high_water = 0;
+}
+
+/*
+ * Drops the names on screen, to be called before the screen is drawn again.
+ */
+void names_reset_shown() {
+	top = NAMES_ARENA_SIZE;
+}
+
+/*
+ * Keeps a name until the directory changes. Returns its offset in the arena,
+ * to be passed to names_get(), or NAMES_NONE if there was no room for it.
+ */
+uint16_t names_keep(const TCHAR* name) {
+	uint16_t offset = bottom;
+	uint16_t size = name_size(name);
+	if (!name_fits(size)) return NAMES_NONE;
+	copy_name(name, offset, size);
+	bottom += size;
+	update_high_water();
+	return offset;
+}
+
+/*
+ * Keeps a name until the screen is drawn again. Returns 0 if there was no
+ * room for it.
+ */
+const char* names_show(const TCHAR* name) {
+	uint16_t size = name_size(name);
+	if (!name_fits(size)) return 0;
+	top -= size;
+	copy_name(name, top, size);
+	update_high_water();
+	return &arena[top];
+}
+
+const char* names_get(uint16_t offset) {
+	if (offset == NAMES_NONE) return 0;
+	return &arena[offset];
+}
+
+void names_get_stats(struct Names_stats* result) {
+	*result = stats;
+	result->kept = bottom;
+	result->shown = NAMES_ARENA_SIZE - top;
+}
+
+void names_reset_stats() {
+	stats.high_water = bottom + (NAMES_ARENA_SIZE - top);
+	stats.overflows = 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NAMES_H
+#define NAMES_H
+
+#ifdef _DISK_IMAGE
+#include <stdint.h>
+#else
+#include <stm32f4xx.h>
+#endif
+#include <ff.h>
+
+/*
+ * Bytes shared by all the long names kept at once, and the offset returned
+ * for a name that didn't fit.
+ */
+#define NAMES_ARENA_SIZE 8192
+#define NAMES_NONE 0xFFFF
+
+/*
+ * Bytes used now by the names kept for the sorted listing and by the names
+ * on screen, the most bytes used at once since names_reset_stats() and since
+ * the directory was opened, and the names that didn't fit.
+ */
+struct Names_stats {
+	uint16_t kept;
+	uint16_t shown;
+	uint16_t high_water;
+	uint16_t directory_high_water;
+	uint16_t overflows;
+};
+
+void names_attach(FILINFO* info);
+void names_reset();
+void names_reset_shown();
+uint16_t names_keep(const TCHAR* name);
+const char* names_show(const TCHAR* name);
+const char* names_get(uint16_t offset);
+void names_get_stats(struct Names_stats* stats);
+void names_reset_stats();
+
+#endif /* NAMES_H */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * NAVIGATION:
+ * The file manager remembers every directory the user went through to reach
+ * the one being shown, with the position of the list in each of them, so
+ * going back restores the list as it was left. Every level records the start
+ * cluster of its directory, so going back up just makes it the current
+ * directory of FatFs again (see f_chcluster()) without following any path,
+ * and going down follows a single name from the current directory.
+ *
+ * The levels are stacked one after another in a byte arena and each one only
+ * takes the room its name needs. The arena always holds NAVIGATION_DEPTH levels
+ * and entering a directory only fails when it is full.
+ */
+
+#include <navigation.h>
+
+static uint8_t arena[NAVIGATION_ARENA_SIZE] __attribute__ ((aligned (4)));
+static uint16_t top;
+static uint16_t used;
+static uint8_t depth;
+
+/*
+ * Empties the stack, leaving only the root directory. Must be called when a
+ * card is mounted, as the mount makes the root the current directory.
+ */
+void navigation_reset() {
+	struct Navigation_level* root = (struct Navigation_level*)arena;
+
+	root->sclust = 0;
+	root->cursor = 0;
+	root->parent_length = 0;
+	root->name_length = 1;
+	root->name[0] = '/';
+	top = 0;
+	used = NAVIGATION_LEVEL_SIZE(1);
+	depth = 0;
+}
+
+/*
+ * Enters a subdirectory of the current directory, by its 8.3 name, and pushes
+ * it on the stack with the list at its beginning. The long name, if there is
+ * one, is what the level keeps to be shown. Returns FR_NOT_ENOUGH_CORE, and
+ * stays where it was, if there is no room left for the level.
+ */
+FRESULT navigation_enter(const TCHAR* name, const char* long_name) {
+	struct Navigation_level* level;
+	const char* shown = long_name ? long_name : name;
+	uint8_t length = 0;
+	DIR directory;
+	FRESULT result;
+
+	while (length < NAVIGATION_NAME_LENGTH && shown[length]) ++length;
+	if (used + NAVIGATION_LEVEL_SIZE(length) > NAVIGATION_ARENA_SIZE)
+		return FR_NOT_ENOUGH_CORE;
+
+	result = f_opendir(&directory, name);
+	if (result != FR_OK) return result;
+	result = f_chcluster(directory.sclust);
+	if (result != FR_OK) return result;
+
+	level = (struct Navigation_level*)(arena + used);
+	level->sclust = directory.sclust;
+	level->cursor = 0;
+	level->parent_length = navigation_current()->name_length;
+	level->name_length = length;
+	for (length = 0; length < level->name_length; ++length)
+		level->name[length] = shown[length];
+	top = used;
+	used += NAVIGATION_LEVEL_SIZE(length);
+	++depth;
+	return FR_OK;
+}
+
+/*
+ * Goes back to the parent of the current directory, which is shown as it was
+ * left.
+ */
+FRESULT navigation_leave() {
+	struct Navigation_level* level = navigation_current();
+	struct Navigation_level* parent;
+	FRESULT result;
+
+	if (!depth) return FR_NO_PATH;
+	parent = (struct Navigation_level*)(arena + top -
+			NAVIGATION_LEVEL_SIZE(level->parent_length));
+	result = f_chcluster(parent->sclust);
+	if (result != FR_OK) return result;
+
+	used = top;
+	top = (uint8_t*)parent - arena;
+	--depth;
+	return FR_OK;
+}
+
+struct Navigation_level* navigation_current() {
+	return (struct Navigation_level*)(arena + top);
+}
+
+uint8_t navigation_depth() {
+	return depth;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NAVIGATION_H
+#define NAVIGATION_H
+
+#include <stm32f4xx.h>
+#include <ff.h>
+
+/*
+ * Deepest level the navigation stack is sure to reach, below the root, and
+ * the characters of the name kept for each level to be shown. A level takes 8
+ * bytes plus its name, rounded up to a multiple of 4, so the arena is sized
+ * for this depth with names of the full length and shorter names leave room
+ * for more levels.
+ */
+#define NAVIGATION_DEPTH 49
+#define NAVIGATION_NAME_LENGTH 12
+
+/*
+ * One level of the navigation stack: the directory, by its start cluster (0
+ * for the root), the first entry shown by the file manager and the name of
+ * the directory to be shown, which is not terminated. The levels are stacked
+ * one after another, so "parent_length", the length of the name of the level
+ * below, is enough to find it.
+ */
+struct Navigation_level {
+	DWORD sclust;
+	uint16_t cursor;
+	uint8_t parent_length;
+	uint8_t name_length;
+	char name[];
+};
+
+#define NAVIGATION_LEVEL_SIZE(name_length) \
+	((sizeof(struct Navigation_level) + (name_length) + 3) & ~3)
+#define NAVIGATION_ARENA_SIZE (NAVIGATION_LEVEL_SIZE(1) + \
+	NAVIGATION_DEPTH * NAVIGATION_LEVEL_SIZE(NAVIGATION_NAME_LENGTH))
+
+void navigation_reset();
+FRESULT navigation_enter(const TCHAR* name, const char* long_name);
+FRESULT navigation_leave();
+struct Navigation_level* navigation_current();
+uint8_t navigation_depth();
+
+#endif /* NAVIGATION_H */
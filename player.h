@@ -20,14 +20,120 @@
 #define select_VS1053_SDI()				GPIO_WriteBit(GPIOD, GPIO_Pin_10, 0)
 #define deselect_VS1053_SDI()			GPIO_WriteBit(GPIOD, GPIO_Pin_10, 1)
 
+/*
+ * SDI data is moved to SPI2 by DMA1, Stream 4 Channel 0 is SPI2_TX. DMA1
+ * can't reach the CCM RAM, data there is sent by the CPU instead.
+ */
+#define SDI_DMA_CLK						RCC_AHB1Periph_DMA1
+#define SDI_DMA_STREAM					DMA1_Stream4
+#define SDI_DMA_CHANNEL					DMA_Channel_0
+#define SDI_DMA_FLAG_FEIF				DMA_FLAG_FEIF4
+#define SDI_DMA_FLAG_DMEIF				DMA_FLAG_DMEIF4
+#define SDI_DMA_FLAG_TEIF				DMA_FLAG_TEIF4
+#define SDI_DMA_FLAG_HTIF				DMA_FLAG_HTIF4
+#define SDI_DMA_FLAG_TCIF				DMA_FLAG_TCIF4
+#define SDI_DMA_IT_TCIF					DMA_IT_TCIF4
+#define SDI_DMA_IRQn					DMA1_Stream4_IRQn
+#define SDI_DMA_CAPABLE(data)			(((uint32_t)(data) & 0xFFFF0000) != 0x10000000)
+
+/*
+ * During playback the VS1053 is fed from interrupts: DREQ (PD9) rising
+ * raises EXTI line 9, and the end of every DMA burst starts the next one
+ * while DREQ stays high. They preempt everything else, the SD card's
+ * interrupts included, so the decoder doesn't wait for anybody.
+ */
+#define SDI_DREQ_EXTI_LINE				EXTI_Line9
+#define SDI_DREQ_EXTI_PORT				EXTI_PortSourceGPIOD
+#define SDI_DREQ_EXTI_PIN				EXTI_PinSource9
+#define SDI_DREQ_IRQn					EXTI9_5_IRQn
+#define SDI_IRQ_PREEMPTION_PRIORITY		((uint8_t)0x00)
+#define SDI_DREQ_IRQ_SUBPRIORITY		((uint8_t)0x00)
+#define SDI_DMA_IRQ_SUBPRIORITY			((uint8_t)0x01)
+
+/*
+ * The FIFO between the card and the interrupt feeder, a power of 2 that can
+ * be set at build time. Together with the chunks already read ahead, up to
+ * 28 KB for lossless files, it must hold 100 ms of the densest stream
+ * played: hi-res FLAC comes at up to about 350 KB/s. A bigger FIFO doesn't
+ * fit in the 128 KB of SRAM next to the read-ahead buffers. The loop that
+ * fills the FIFO hands over to the user interface above the high watermark,
+ * and leaves the catalog and other background work alone under the low one.
+ */
+#ifndef SDI_FIFO_SIZE
+#define SDI_FIFO_SIZE					16384
+#endif
+#define SDI_FIFO_LOW_WATERMARK			(SDI_FIFO_SIZE / 4)
+#define SDI_FIFO_HIGH_WATERMARK			(SDI_FIFO_SIZE / 4 * 3)
+
+/*
+ * What sending SDI data has cost since ResetSdiStatistics(): the bytes and
+ * the bursts of at most 32 bytes they were sent in, the CPU cycles spent
+ * moving them (setting up the DMA or sending byte by byte, and waiting for
+ * the end of a burst, in the interrupts too) and the cycles WriteSdi() spent
+ * waiting for DREQ, which the interrupt feeder never does.
+ */
+struct Sdi_statistics {
+	uint32_t bytes;
+	uint32_t bursts;
+	uint32_t transport_cycles;
+	uint32_t dreq_cycles;
+};
+
+/*
+ * How the FIFO of the interrupt feeder did during the last track: its
+ * lowest fill once playback got going, and the times the VS1053 asked for
+ * data and found it empty, the end of the track and seeks aside.
+ */
+struct Sdi_fifo_statistics {
+	uint32_t size;
+	uint32_t min_fill;
+	uint32_t underruns;
+};
+
+/*
+ * What the last LoadPlugin() took: the words written, the times the VS1053
+ * was selected for them and the CPU cycles.
+ */
+struct Plugin_statistics {
+	uint32_t words;
+	uint32_t selects;
+	uint32_t cycles;
+};
+
 void GPIOVS1053_Init();
 int VSTestInitHardware(void);
 int VSTestInitSoftware(void);
 int VSTestHandleFile(char *fileName, int record);
+int VSTestPlayTree(char *directory);
+int VSTestPlayList(char *playlist);
 
 void WriteSci(u_int8 addr, u_int16 data);
 u_int16 ReadSci(u_int8 addr);
 int WriteSdi(const u_int8 *data, u_int8 bytes);
+void SciBatchBegin(void);
+void SciBatchWrite(u_int8 addr, u_int16 data);
+void SciBatchEnd(void);
+void SciUseBatches(uint8_t enable);
+void WriteVS10xxMem32(uint16_t addr, uint32_t data);
+uint32_t ReadVS10xxMem32(uint16_t addr);
+void GetPluginStatistics(struct Plugin_statistics *statistics);
+void SPI2_SendBurst(const uint8_t *data, uint32_t length);
+void GetSpiClocks(uint32_t *write_hz, uint32_t *read_hz);
+void WaitSdi(void);
+uint8_t SdiBusy(void);
+void SdiUseDma(uint8_t enable);
+void GetSdiStatistics(struct Sdi_statistics *statistics);
+void ResetSdiStatistics(void);
+void SdiFeedStart(void);
+void SdiFeedStop(void);
+uint32_t SdiFeedWrite(const u_int8 *data, uint32_t bytes);
+uint32_t SdiFeedFill(void);
+void SdiFeedPause(uint8_t pause);
+void SdiFeedDrain(void);
+void SdiFeedFlush(void);
+void GetSdiFifoStatistics(struct Sdi_fifo_statistics *statistics);
+void SdiProcessDreqIRQ(void);
+void SdiProcessDMAIRQ(void);
 void SaveUIState(void);
 void RestoreUIState(void);
 int GetUICommand(void);
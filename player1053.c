@@ -43,6 +43,10 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stm32f4xx_spi.h>
+#include <stm32f4xx_dma.h>
+#include <stm32f4xx_exti.h>
+#include <stm32f4xx_syscfg.h>
+#include <misc.h>
 #include <delay.h>
 #include <lcd.h>
 #include <ff.h>
@@ -51,6 +55,11 @@
 #include "player.h"
 #include <apps.h>
 #include <utils.h>
+#include <readahead.h>
+#include <catalog.h>
+#include <probe.h>
+#include <tree.h>
+#include <playlist.h>
 
 /*
  * Download the latest VS1053a Patches package and its
@@ -85,7 +94,7 @@ const u_int16 imaFix[] = {
 #undef SKIP_PLUGIN_VARNAME
 
 
-#define FILE_BUFFER_SIZE 512
+#define FILE_BUFFER_SIZE 4096
 #define SDI_MAX_TRANSFER_SIZE 32
 #define SDI_END_FILL_BYTES_FLAC 12288
 #define SDI_END_FILL_BYTES       2050
@@ -151,11 +160,65 @@ extern const uint16_t speaker_on[];
 extern const uint16_t speaker_off[];
 
 extern char current_directory_path[20];
-extern uint8_t depth;
 extern uint8_t volume;
 extern uint8_t volume_step;
 extern uint8_t mute;
 
+/*
+ * SDI transfers: whether they go by DMA, whether a burst is being sent and
+ * what they've cost so far.
+ */
+static uint8_t sdi_dma = 0;
+static volatile uint8_t sdi_burst = 0;
+static struct Sdi_statistics sdi_statistics;
+
+/*
+ * Interrupt feeder: the FIFO the playback loop fills and the interrupts
+ * drain, with free running read and write counts (SDI_FIFO_SIZE is a power
+ * of 2). The read count moves when a burst is over, so the bytes being sent
+ * can't be overwritten. The feeder stops while it's on hold for an SCI
+ * transfer or paused.
+ */
+static uint8_t sdi_fifo[SDI_FIFO_SIZE] __attribute__ ((aligned (16)));
+static volatile uint32_t fifo_read;
+static volatile uint32_t fifo_write;
+static volatile uint8_t sdi_feeding = 0;
+static volatile uint8_t sdi_hold = 0;
+static volatile uint8_t sdi_paused = 0;
+static uint8_t burst_length;
+
+/*
+ * FIFO statistics of the track being played. They're taken when the loop
+ * comes back with data: the fill then is the lowest since its last visit,
+ * and an empty FIFO the VS1053 found meanwhile is an underrun. So the end
+ * of the track, where nothing comes back, isn't one. Counting starts once
+ * the FIFO has reached the low watermark, again after a seek.
+ */
+static struct Sdi_fifo_statistics fifo_statistics;
+static uint8_t fifo_primed;
+static volatile uint8_t fifo_starved;
+
+/*
+ * SPI2 prescalers for SCI reads and for everything else, see
+ * SelectSpiClock(), and the one SPI2 is set to.
+ */
+static uint16_t spi_write_prescaler = SPI_BaudRatePrescaler_16;
+static uint16_t spi_read_prescaler = SPI_BaudRatePrescaler_16;
+static uint16_t spi_prescaler = SPI_BaudRatePrescaler_16;
+
+/*
+ * SCI batches, see SciBatchBegin(): whether they're used, whether one is
+ * open and the register of the run the VS1053 is selected for, if any.
+ * Every time the VS1053 is selected for SCI is counted in "sci_selects".
+ */
+#define SCI_NO_RUN 0xFF
+#define SCI_DREQ_FALL_US 2
+static uint8_t sci_batches = 1;
+static uint8_t sci_batch = 0;
+static uint8_t sci_run = SCI_NO_RUN;
+static uint32_t sci_selects;
+static struct Plugin_statistics plugin_statistics;
+
 enum AudioFormat {
 	afUnknown,
 	afRiff,
@@ -186,6 +249,19 @@ const char *afName[] = {
 	"MIDI",
 };
 
+/*
+ * Unmasks or masks the interrupt raised when DREQ goes high.
+ */
+static void DreqInterrupt(FunctionalState state) {
+	EXTI_InitTypeDef DREQ_Settings;
+
+	DREQ_Settings.EXTI_Line = SDI_DREQ_EXTI_LINE;
+	DREQ_Settings.EXTI_Mode = EXTI_Mode_Interrupt;
+	DREQ_Settings.EXTI_Trigger = EXTI_Trigger_Rising;
+	DREQ_Settings.EXTI_LineCmd = state;
+	EXTI_Init(&DREQ_Settings);
+}
+
 void GPIOVS1053_Init() {
 	//Commands below were ready done for GPIOB and GPIOD
 	//RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB, ENABLE);
@@ -250,6 +326,57 @@ void GPIOVS1053_Init() {
 	SPI_Init(SPI2, &SPI2_Settings);
 
 	SPI_Cmd(SPI2, ENABLE);
+
+	/*
+	 * The DMA stream that sends SDI data. Its address and length are set for
+	 * every burst, the SPI requests it only while the stream is enabled.
+	 */
+	RCC_AHB1PeriphClockCmd(SDI_DMA_CLK, ENABLE);
+
+	DMA_InitTypeDef SDI_DMA_Settings;
+
+	DMA_DeInit(SDI_DMA_STREAM);
+	SDI_DMA_Settings.DMA_Channel = SDI_DMA_CHANNEL;
+	SDI_DMA_Settings.DMA_PeripheralBaseAddr = (uint32_t)&SPI2->DR;
+	SDI_DMA_Settings.DMA_Memory0BaseAddr = 0;
+	SDI_DMA_Settings.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+	SDI_DMA_Settings.DMA_BufferSize = SDI_MAX_TRANSFER_SIZE;
+	SDI_DMA_Settings.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	SDI_DMA_Settings.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	SDI_DMA_Settings.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	SDI_DMA_Settings.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	SDI_DMA_Settings.DMA_Mode = DMA_Mode_Normal;
+	SDI_DMA_Settings.DMA_Priority = DMA_Priority_High;
+	SDI_DMA_Settings.DMA_FIFOMode = DMA_FIFOMode_Disable;
+	SDI_DMA_Settings.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	SDI_DMA_Settings.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	SDI_DMA_Settings.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+
+	DMA_Init(SDI_DMA_STREAM, &SDI_DMA_Settings);
+
+	SPI_I2S_DMACmd(SPI2, SPI_I2S_DMAReq_Tx, ENABLE);
+	sdi_dma = 1;
+
+	/*
+	 * DREQ on EXTI line 9 and the end of the DMA bursts, both left masked
+	 * until SdiFeedStart().
+	 */
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+	SYSCFG_EXTILineConfig(SDI_DREQ_EXTI_PORT, SDI_DREQ_EXTI_PIN);
+	DreqInterrupt(DISABLE);
+
+	NVIC_InitTypeDef SDI_NVIC_Settings;
+
+	NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
+	SDI_NVIC_Settings.NVIC_IRQChannel = SDI_DREQ_IRQn;
+	SDI_NVIC_Settings.NVIC_IRQChannelPreemptionPriority = SDI_IRQ_PREEMPTION_PRIORITY;
+	SDI_NVIC_Settings.NVIC_IRQChannelSubPriority = SDI_DREQ_IRQ_SUBPRIORITY;
+	SDI_NVIC_Settings.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&SDI_NVIC_Settings);
+
+	SDI_NVIC_Settings.NVIC_IRQChannel = SDI_DMA_IRQn;
+	SDI_NVIC_Settings.NVIC_IRQChannelSubPriority = SDI_DMA_IRQ_SUBPRIORITY;
+	NVIC_Init(&SDI_NVIC_Settings);
 }
 
 uint8_t SPI2_Send(uint8_t data) {
@@ -260,41 +387,254 @@ uint8_t SPI2_Send(uint8_t data) {
 	return SPI2->DR;							//return received data from SPI data register
 }
 
+/*
+ * Waits for the last byte sent to leave the SPI. Nothing received was read
+ * meanwhile, so the receive register overran: reading DR and then SR clears
+ * it for the next SPI2_Send().
+ */
+static void SPI2_EndBurst(void) {
+	while (!(SPI2->SR & SPI_I2S_FLAG_TXE));
+	while (SPI2->SR & SPI_I2S_FLAG_BSY);
+	(void)SPI2->DR;
+	(void)SPI2->SR;
+}
+
+/*
+ * Sends bytes whose answer doesn't matter. Every byte is written as soon as
+ * the transmit register is free, while the one before is still being
+ * shifted out, so the clock never stops between them.
+ */
+void SPI2_SendBurst(const uint8_t *data, uint32_t length) {
+	while (length--) {
+		while (!(SPI2->SR & SPI_I2S_FLAG_TXE));
+		SPI2->DR = *data++;
+	}
+	SPI2_EndBurst();
+}
+
+/*
+ * Changes the SPI2 clock, which is PCLK1 divided by the prescaler. It's
+ * never done in the middle of a transfer.
+ */
+static void SetSpiPrescaler(uint16_t prescaler) {
+	if (prescaler == spi_prescaler) return;
+	SPI_Cmd(SPI2, DISABLE);
+	SPI2->CR1 = (SPI2->CR1 & ~SPI_BaudRatePrescaler_256) | prescaler;
+	SPI_Cmd(SPI2, ENABLE);
+	spi_prescaler = prescaler;
+}
+
+/*
+ * SCI and SDI share the SPI: an SCI transfer puts the interrupt feeder on
+ * hold and waits for its burst, if any, to end. Releasing it lets the
+ * feeder catch up through a software interrupt on the DREQ line.
+ */
+static void HoldSdi(void) {
+	sdi_hold = 1;
+	WaitSdi();
+}
+
+static void ReleaseSdi(void) {
+	sdi_hold = 0;
+	if (sdi_feeding) EXTI_GenerateSWInterrupt(SDI_DREQ_EXTI_LINE);
+}
+
 void WriteSci(u_int8 addr, u_int16 data) {
+	uint8_t command[4];
+
+	command[0] = 2;
+	command[1] = addr;
+	command[2] = (uint8_t)((data >> 8) & 0x00FF);
+	command[3] = (uint8_t)(data & 0x00FF);
+
+	HoldSdi();
 	while (GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9) == 0);
 	select_VS1053_SCI();
+	++sci_selects;
 	Delay_1inst();
 
-	SPI2_Send(2);
-	SPI2_Send(addr);
-	SPI2_Send((uint8_t)((data >> 8) & 0x00FF));
-	SPI2_Send((uint8_t)(data & 0x00FF));
+	SPI2_SendBurst(command, 4);
 
 	deselect_VS1053_SCI();
+	ReleaseSdi();
 }
 
 u_int16 ReadSci(u_int8 addr) {
 	uint16_t data;
+	uint8_t command[2];
+
+	command[0] = 3;
+	command[1] = addr;
 
+	HoldSdi();
 	while (GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9) == 0);
+	//SCI reads have a lower speed limit than writes.
+	SetSpiPrescaler(spi_read_prescaler);
 	select_VS1053_SCI();
+	++sci_selects;
 	Delay_1inst();
 
-	SPI2_Send(3);
-	SPI2_Send(addr);
+	SPI2_SendBurst(command, 2);
 	data = (uint16_t)SPI2_Send(0xFF) << 8;
 	data |= (uint16_t)SPI2_Send(0xFF);
 
 	deselect_VS1053_SCI();
+	SetSpiPrescaler(spi_write_prescaler);
+	ReleaseSdi();
 	return data;
 }
 
+/*
+ * SCI BATCHES:
+ * WriteSci() puts the interrupt feeder on hold, selects the VS1053 and sends
+ * the command and the register for every single word. The VS1053 also takes
+ * several words for the same register in a row, the way plugins are loaded:
+ * after each word it holds DREQ low while the register is updated, and the
+ * next word follows once it's high again, with the VS1053 still selected.
+ *
+ * Between SciBatchBegin() and SciBatchEnd() the feeder stays on hold and
+ * consecutive SciBatchWrite() calls for the same register are sent as one
+ * run, with a single command. Nothing else may use the SPI meanwhile, SCI
+ * reads included. The runs aren't sent by DMA: DREQ must be waited for
+ * between their words, as a register update takes longer than the next
+ * word at these clocks.
+ */
+static void EndSciRun(void) {
+	if (sci_run == SCI_NO_RUN) return;
+	deselect_VS1053_SCI();
+	sci_run = SCI_NO_RUN;
+}
+
+void SciBatchBegin(void) {
+	if (!sci_batches || sci_batch) return;
+	HoldSdi();
+	sci_batch = 1;
+}
+
+void SciBatchWrite(u_int8 addr, u_int16 data) {
+	uint8_t command[2];
+
+	if (!sci_batch) {
+		WriteSci(addr, data);
+		return;
+	}
+
+	if (addr != sci_run) {
+		EndSciRun();
+		while (GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9) == 0);
+		select_VS1053_SCI();
+		++sci_selects;
+		Delay_1inst();
+		command[0] = 2;
+		command[1] = addr;
+		SPI2_SendBurst(command, 2);
+		sci_run = addr;
+	}
+	else {
+		/*
+		 * DREQ falls a few CLKI cycles after the last bit of the previous
+		 * word, and may still be high from before it. Wait for it to fall,
+		 * for no longer than SCI_DREQ_FALL_US, then for the update to end.
+		 */
+		uint32_t start = get_cycles();
+		while (GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9)
+				&& get_cycles() - start < SCI_DREQ_FALL_US * CPU_FREQUENCY_MHZ);
+		while (GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9) == 0);
+	}
+
+	command[0] = (uint8_t)((data >> 8) & 0x00FF);
+	command[1] = (uint8_t)(data & 0x00FF);
+	SPI2_SendBurst(command, 2);
+}
+
+void SciBatchEnd(void) {
+	if (!sci_batch) return;
+	EndSciRun();
+	sci_batch = 0;
+	ReleaseSdi();
+}
+
+/*
+ * Chooses between batched SCI writes, the default, and one WriteSci() per
+ * word, to compare them.
+ */
+void SciUseBatches(uint8_t enable) {
+	sci_batches = enable;
+}
+
+void GetPluginStatistics(struct Plugin_statistics *statistics) {
+	*statistics = plugin_statistics;
+}
+
+/*
+ * Ends an SDI burst sent by DMA once it has left the SPI, deselecting the
+ * VS1053.
+ */
+static void EndSdiBurst(void) {
+	SPI2_EndBurst();
+	deselect_VS1053_SDI();
+	sdi_burst = 0;
+}
+
+/*
+ * Waits for the SDI burst being sent by DMA, if any, to end. While the
+ * interrupt feeder runs, its interrupt ends the burst.
+ */
+void WaitSdi(void) {
+	if (!sdi_burst) return;
+
+	uint32_t start = get_cycles();
+	if (sdi_feeding) {
+		while (sdi_burst);
+	}
+	else {
+		while (!DMA_GetFlagStatus(SDI_DMA_STREAM, SDI_DMA_FLAG_TCIF));
+		EndSdiBurst();
+	}
+	sdi_statistics.transport_cycles += get_cycles() - start;
+}
+
+/*
+ * Tells if an SDI burst is still being sent, so the caller can do something
+ * else instead of waiting for it in WaitSdi().
+ */
+uint8_t SdiBusy(void) {
+	return sdi_burst && (!DMA_GetFlagStatus(SDI_DMA_STREAM, SDI_DMA_FLAG_TCIF)
+			|| !(SPI2->SR & SPI_I2S_FLAG_TXE) || (SPI2->SR & SPI_I2S_FLAG_BSY));
+}
+
+/*
+ * Chooses between sending SDI data by DMA, the default, and byte by byte.
+ */
+void SdiUseDma(uint8_t enable) {
+	WaitSdi();
+	sdi_dma = enable;
+}
+
+void GetSdiStatistics(struct Sdi_statistics *statistics) {
+	*statistics = sdi_statistics;
+}
+
+void ResetSdiStatistics(void) {
+	sdi_statistics.bytes = 0;
+	sdi_statistics.bursts = 0;
+	sdi_statistics.transport_cycles = 0;
+	sdi_statistics.dreq_cycles = 0;
+}
+
+/*
+ * Sends up to 32 bytes of SDI data once DREQ allows it. By DMA the function
+ * returns as soon as the burst is started, the data must stay untouched
+ * until WaitSdi() or any other SCI or SDI transfer, which waits for it.
+ * Not to be used while the interrupt feeder runs.
+ */
 int WriteSdi(const u_int8 *data, u_int8 bytes) {
 	if (bytes > 32) return -1;
 
-	uint8_t i;
-
+	WaitSdi();
+	uint32_t start = get_cycles();
 	while (GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9) == 0);
+	uint32_t ready = get_cycles();
 	select_VS1053_SDI();
 	/*
 	 * Gives a delay of approximately 5,9 nanoseconds while the minimum waiting
@@ -302,13 +642,199 @@ int WriteSdi(const u_int8 *data, u_int8 bytes) {
 	 */
 	Delay_1inst();
 
-	for (i = 0; i < bytes; ++i)
-		SPI2_Send(data[i]);
+	if (sdi_dma && SDI_DMA_CAPABLE(data)) {
+		DMA_ClearFlag(SDI_DMA_STREAM, SDI_DMA_FLAG_FEIF | SDI_DMA_FLAG_DMEIF |
+				SDI_DMA_FLAG_TEIF | SDI_DMA_FLAG_HTIF | SDI_DMA_FLAG_TCIF);
+		SDI_DMA_STREAM->M0AR = (uint32_t)data;
+		SDI_DMA_STREAM->NDTR = bytes;
+		DMA_Cmd(SDI_DMA_STREAM, ENABLE);
+		sdi_burst = 1;
+	}
+	else {
+		SPI2_SendBurst(data, bytes);
+		deselect_VS1053_SDI();
+	}
 
-	deselect_VS1053_SDI();
+	sdi_statistics.bytes += bytes;
+	++sdi_statistics.bursts;
+	sdi_statistics.dreq_cycles += ready - start;
+	sdi_statistics.transport_cycles += get_cycles() - ready;
 	return 0;
 }
 
+/*
+ * INTERRUPT FEEDER:
+ * Feeding the VS1053 from the playback loop meant that anything else the
+ * loop did, like drawing or the short delays that animate the buttons, left
+ * the decoder waiting. During playback the loop only fills sdi_fifo, and
+ * the VS1053 is fed from there by interrupts whenever it asks for data.
+ *
+ * DREQ rising starts a burst of up to 32 bytes, by DMA, and the end of the
+ * burst starts the next one while DREQ stays high. Without DMA the bytes
+ * are sent right away from the interrupt, as long as DREQ is high. Bursts
+ * never cross the end of the FIFO, they're cut there.
+ */
+static void FeedSdi(void) {
+	uint32_t start = get_cycles();
+
+	while (sdi_feeding && !sdi_hold && !sdi_paused && !sdi_burst &&
+			GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_9)) {
+		uint32_t fill = fifo_write - fifo_read;
+		uint32_t offset = fifo_read & (SDI_FIFO_SIZE - 1);
+		uint8_t bytes;
+
+		if (!fill) {
+			fifo_starved = 1;
+			break;
+		}
+		bytes = min(min(fill, SDI_FIFO_SIZE - offset), SDI_MAX_TRANSFER_SIZE);
+
+		select_VS1053_SDI();
+		Delay_1inst();
+		if (sdi_dma && SDI_DMA_CAPABLE(sdi_fifo)) {
+			DMA_ClearFlag(SDI_DMA_STREAM, SDI_DMA_FLAG_FEIF | SDI_DMA_FLAG_DMEIF |
+					SDI_DMA_FLAG_TEIF | SDI_DMA_FLAG_HTIF | SDI_DMA_FLAG_TCIF);
+			SDI_DMA_STREAM->M0AR = (uint32_t)&sdi_fifo[offset];
+			SDI_DMA_STREAM->NDTR = bytes;
+			burst_length = bytes;
+			sdi_burst = 1;
+			DMA_Cmd(SDI_DMA_STREAM, ENABLE);
+		}
+		else {
+			SPI2_SendBurst(&sdi_fifo[offset], bytes);
+			deselect_VS1053_SDI();
+			fifo_read += bytes;
+		}
+		sdi_statistics.bytes += bytes;
+		++sdi_statistics.bursts;
+	}
+	sdi_statistics.transport_cycles += get_cycles() - start;
+}
+
+/*
+ * DREQ went high, or the feeder was given something to do.
+ */
+void SdiProcessDreqIRQ(void) {
+	if (EXTI_GetITStatus(SDI_DREQ_EXTI_LINE) != RESET) {
+		EXTI_ClearITPendingBit(SDI_DREQ_EXTI_LINE);
+		FeedSdi();
+	}
+}
+
+/*
+ * A DMA burst has been moved to the SPI.
+ */
+void SdiProcessDMAIRQ(void) {
+	if (DMA_GetITStatus(SDI_DMA_STREAM, SDI_DMA_IT_TCIF) != RESET) {
+		uint32_t start = get_cycles();
+		DMA_ClearITPendingBit(SDI_DMA_STREAM, SDI_DMA_IT_TCIF);
+		EndSdiBurst();
+		fifo_read += burst_length;
+		sdi_statistics.transport_cycles += get_cycles() - start;
+		FeedSdi();
+	}
+}
+
+/*
+ * Starts feeding the VS1053 from interrupts, with an empty FIFO.
+ */
+void SdiFeedStart(void) {
+	WaitSdi();
+	fifo_read = 0;
+	fifo_write = 0;
+	fifo_primed = 0;
+	fifo_starved = 0;
+	fifo_statistics.size = SDI_FIFO_SIZE;
+	fifo_statistics.min_fill = SDI_FIFO_SIZE;
+	fifo_statistics.underruns = 0;
+	sdi_paused = 0;
+	sdi_hold = 0;
+	sdi_feeding = 1;
+	DMA_ITConfig(SDI_DMA_STREAM, DMA_IT_TC, ENABLE);
+	DreqInterrupt(ENABLE);
+	EXTI_GenerateSWInterrupt(SDI_DREQ_EXTI_LINE);
+}
+
+/*
+ * Stops the interrupt feeder, dropping what's left in the FIFO.
+ */
+void SdiFeedStop(void) {
+	if (!sdi_feeding) return;
+	HoldSdi();
+	DreqInterrupt(DISABLE);
+	DMA_ITConfig(SDI_DMA_STREAM, DMA_IT_TC, DISABLE);
+	sdi_feeding = 0;
+	sdi_hold = 0;
+	fifo_read = fifo_write;
+}
+
+/*
+ * Copies as much data as fits into the FIFO and returns how much it was.
+ */
+uint32_t SdiFeedWrite(const u_int8 *data, uint32_t bytes) {
+	uint32_t fill = fifo_write - fifo_read;
+	uint32_t space = SDI_FIFO_SIZE - fill;
+	uint32_t offset = fifo_write & (SDI_FIFO_SIZE - 1);
+	uint32_t first;
+
+	if (bytes > space) bytes = space;
+	if (!bytes) return 0;
+	if (fifo_primed) {
+		if (fill < fifo_statistics.min_fill) fifo_statistics.min_fill = fill;
+		if (fifo_starved) ++fifo_statistics.underruns;
+	}
+	fifo_starved = 0;
+	first = min(bytes, SDI_FIFO_SIZE - offset);
+	mem_cpy(&sdi_fifo[offset], (void*)data, first);
+	if (first < bytes) mem_cpy(sdi_fifo, (void*)(data + first), bytes - first);
+	fifo_write += bytes;
+	if (fill + bytes >= SDI_FIFO_LOW_WATERMARK) fifo_primed = 1;
+
+	if (!sdi_burst) EXTI_GenerateSWInterrupt(SDI_DREQ_EXTI_LINE);
+	return bytes;
+}
+
+/*
+ * Bytes waiting in the FIFO.
+ */
+uint32_t SdiFeedFill(void) {
+	return fifo_write - fifo_read;
+}
+
+/*
+ * Pausing keeps the rest of the FIFO for when the playback goes on.
+ */
+void SdiFeedPause(uint8_t pause) {
+	if (sdi_paused == pause) return;
+	sdi_paused = pause;
+	if (!pause && sdi_feeding) EXTI_GenerateSWInterrupt(SDI_DREQ_EXTI_LINE);
+}
+
+/*
+ * Waits until everything in the FIFO has been sent.
+ */
+void SdiFeedDrain(void) {
+	while (sdi_feeding && !sdi_paused && (fifo_write != fifo_read || sdi_burst));
+}
+
+/*
+ * Drops what's in the FIFO, after a seek.
+ */
+void SdiFeedFlush(void) {
+	HoldSdi();
+	fifo_read = fifo_write;
+	fifo_primed = 0;
+	fifo_starved = 0;
+	ReleaseSdi();
+}
+
+/*
+ * The FIFO statistics of the track being played, or of the last one.
+ */
+void GetSdiFifoStatistics(struct Sdi_fifo_statistics *statistics) {
+	*statistics = fifo_statistics;
+}
+
 /*
  * Function that sets a region of memory to some value. It is taken from Chan's
  * FF module.
@@ -364,17 +890,21 @@ uint16_t ReadVS10xxMem(uint16_t addr) {
  * Write 16-bit value to given VS10xx address
  */
 void WriteVS10xxMem(uint16_t addr, uint16_t data) {
-	WriteSci(SCI_WRAMADDR, addr);
-	WriteSci(SCI_WRAM, data);
+	SciBatchBegin();
+	SciBatchWrite(SCI_WRAMADDR, addr);
+	SciBatchWrite(SCI_WRAM, data);
+	SciBatchEnd();
 }
 
 /*
  * Write 32-bit value to given VS10xx address
  */
 void WriteVS10xxMem32(uint16_t addr, uint32_t data) {
-	WriteSci(SCI_WRAMADDR, addr);
-	WriteSci(SCI_WRAM, (uint16_t)data);
-	WriteSci(SCI_WRAM, (uint16_t)(data>>16));
+	SciBatchBegin();
+	SciBatchWrite(SCI_WRAMADDR, addr);
+	SciBatchWrite(SCI_WRAM, (uint16_t)data);
+	SciBatchWrite(SCI_WRAM, (uint16_t)(data>>16));
+	SciBatchEnd();
 }
 
 static const uint16_t linToDBTab[5] = {36781, 41285, 46341, 52016, 58386};
@@ -409,28 +939,38 @@ static uint16_t LinToDB(unsigned short n) {
  * Loads a plugin.
  *
  * This is a slight modification of the LoadUserCode() example
- * provided in many of VLSI Solution's program packages.
+ * provided in many of VLSI Solution's program packages. The writes are
+ * batched, and what loading took is kept for GetPluginStatistics().
  */
 void LoadPlugin(const uint16_t *d, uint16_t len) {
 	int i = 0;
+	uint32_t start = get_cycles();
+	uint32_t selects = sci_selects;
 
+	plugin_statistics.words = 0;
+	SciBatchBegin();
 	while (i<len) {
 		unsigned short addr, n, val;
 		addr = d[i++];
 		n = d[i++];
 		if (n & 0x8000U) { //RLE run, replicate n samples
 			n &= 0x7FFF;
+			plugin_statistics.words += n;
 			val = d[i++];
 			while (n--) {
-				WriteSci(addr, val);
+				SciBatchWrite(addr, val);
 			}
 		} else {           //Copy run, copy n samples
+			plugin_statistics.words += n;
 			while (n--) {
 				val = d[i++];
-				WriteSci(addr, val);
+				SciBatchWrite(addr, val);
 			}
 		}
 	}
+	SciBatchEnd();
+	plugin_statistics.selects = sci_selects - selects;
+	plugin_statistics.cycles = get_cycles() - start;
 }
 
 enum PlayerStates {
@@ -442,7 +982,8 @@ enum PlayerStates {
 } playerState;
 
 /*
- * This function plays back an audio file.
+ * This function plays back an audio file, which was already probed (see
+ * probe.c) and is at the offset where audio starts.
  *
  * It also contains a simple user interface, which requires the following
  * funtions that you must provide:
@@ -457,7 +998,7 @@ enum PlayerStates {
  * - Returns -2 for cancel playback command
  * - Returns any other for user input. For supported commands, see code.
  */
-uint8_t VS1053PlayFile(FIL* audio_file) {
+uint8_t VS1053PlayFile(FIL* audio_file, const struct Media_info* media) {
 	struct Box folder_up;
 	folder_up.x_start = 0;
 	folder_up.y_start = 0;
@@ -552,8 +1093,9 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
 	paint_areaLCD(volume_up_button.x_start, 56, 479, first_black_y_pixel - 1, 0xFFFF);
 	paint_areaLCD(volume_up_button.x_start, first_black_y_pixel, 479, 247, 0x0000);
 
-	static uint8_t playBuf[FILE_BUFFER_SIZE];
-	uint32_t bytesInBuffer;        				//How many bytes in buffer left
+	static uint8_t playBuf[FILE_BUFFER_SIZE] __attribute__ ((aligned (16)));
+	uint32_t bytesInBuffer = 0;    				//How many bytes in buffer left
+	uint8_t *bufP = playBuf;       				//Next byte of the buffer to send
 	uint32_t pos=0;                				//File position
 	int endFillByte = 0;           				//What byte value to send after file
 	int endFillBytes = SDI_END_FILL_BYTES; 		//How many of those to send
@@ -586,33 +1128,59 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
 	SaveUIState();
 #endif /* PLAYER_USER_INTERFACE */
 
+  	/*
+  	 * The format is known before streaming, so FLAC gets its longer end fill
+  	 * from the start. As in the report below, an unknown format gets the
+  	 * longer one too, to be safe. The MEDIA_ formats are in the same order as
+  	 * AudioFormat.
+  	 */
+  	audioFormat = (enum AudioFormat)media->format;
+  	if (audioFormat == afFlac || audioFormat == afUnknown)
+  		endFillBytes = SDI_END_FILL_BYTES_FLAC;
+
   	playerState = psPlayback;             // Set state to normal playback
 
   	WriteSci(SCI_DECODE_TIME, 0);         // Reset DECODE_TIME
 
   	reset_touch_fifo();
 
+  	//From now on the VS1053 is fed by interrupts, see FeedSdi().
+  	SdiFeedStart();
+
     //Main playback loop
   	while (!leave_playback/*playerState != psStopped*/) {
+  		SdiFeedPause(playerState == psPaused);
   		if ((playerState != psPaused) && (playerState != psStopped)) {
-  			if ((f_read(audio_file, playBuf, FILE_BUFFER_SIZE, (UINT*)&bytesInBuffer) == FR_OK) && (bytesInBuffer > 0)) {
+  			/*
+  			 * A buffer that didn't fit in the FIFO of the interrupt feeder
+  			 * is finished before reading the next one.
+  			 */
+  			if (!bytesInBuffer) {
+  				bufP = playBuf;
+  				if (readahead_active())
+  					bytesInBuffer = readahead_next(&bufP);
+  				else if (f_read(audio_file, playBuf, FILE_BUFFER_SIZE, (UINT*)&bytesInBuffer) != FR_OK)
+  					bytesInBuffer = 0;
+  			}
 
-  				uint8_t *bufP = playBuf;
+  			if (bytesInBuffer > 0) {
 
   				while (bytesInBuffer && playerState != psStopped) {
 
   					if ((playerState != psPaused) && !(playMode & PAR_PLAY_MODE_PAUSE_ENA)) {
-  						int t = min(SDI_MAX_TRANSFER_SIZE, bytesInBuffer);
-
   						/*
   						 * This is the heart of the algorithm: on the following line
-  						 * actual audio data gets sent to VS10xx.
+  						 * actual audio data is queued for the VS10xx, as much as
+  						 * the FIFO takes.
   						 */
-  						WriteSdi(bufP, t);
+  						int t = SdiFeedWrite(bufP, bytesInBuffer);
 
   						bufP += t;
   						bytesInBuffer -= t;
   						pos += t;
+
+  						//Meanwhile the next chunks of the file are read from the card.
+  						readahead_poll();
   					}
 
   					//If the user has requested cancel, set VS10xx SM_CANCEL bit
@@ -632,9 +1200,13 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
   						if (!(mode & SM_CANCEL)) {
   							playerState = psStopped;
   							if (petition_to_stop) {
+  								SdiFeedFlush();
+  								bytesInBuffer = 0;
   								WriteSci(SCI_DECODE_TIME, 0);
-  								if (f_lseek(audio_file, 0) != FR_OK)
+  								if (f_lseek(audio_file, media->audio_offset) != FR_OK)
   									leave_playback = 1;
+  								else if (readahead_active())
+  									readahead_seek(media->audio_offset);
   							}
   							else if (petition_to_leave) {
   								leave_playback = 1;
@@ -725,6 +1297,14 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
   						fflush(stdout);
 #endif /* REPORT_ON_SCREEN */
   					}
+
+  					/*
+  					 * Above the high watermark there's time for the user
+  					 * interface, the rest of the buffer waits for the next
+  					 * round.
+  					 */
+  					if (SdiFeedFill() >= SDI_FIFO_HIGH_WATERMARK)
+  						break;
   				}
   			}
   			else {
@@ -736,6 +1316,20 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
   				leave_playback = 1;
   		}
 
+  		/*
+  		 * The catalog of the card may still be built. It's crawled for a
+  		 * short while when the playback is paused or stopped, or when the
+  		 * FIFO of the interrupt feeder is above the low watermark, which
+  		 * leaves tens of milliseconds before it runs dry. When a folder tree is
+  		 * played, finding the next file of the tree comes first, and so does
+  		 * resolving the next entries of a playlist.
+  		 */
+  		if (!leave_playback && (playerState == psPaused || playerState == psStopped
+  				|| SdiFeedFill() >= SDI_FIFO_LOW_WATERMARK)) {
+  			if (!tree_prefetch() && !playlist_prefetch())
+  				catalog_step(detect_touch);
+  		}
+
   		/*
   		 * User interface. This can of course be completely removed and
 		 * basic playback would still work.
@@ -1117,11 +1711,19 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
   	RestoreUIState();
 #endif /* PLAYER_USER_INTERFACE */
 
+  	/*
+  	 * At the end of the file the FIFO is played out, otherwise it's
+  	 * dropped. Then the loop below feeds the VS1053 itself again.
+  	 */
+  	if (playerState == psPlayback) SdiFeedDrain();
+  	SdiFeedStop();
+
   	/*
   	 * Earlier we collected endFillByte. Now, just in case the file was
 	 * broken, or if a cancel playback command has been given, write
 	 * lots of endFillBytes.
 	 */
+  	WaitSdi();
   	mem_set(playBuf, endFillByte, sizeof(playBuf));
   	for (i=0; i<endFillBytes; i+=SDI_MAX_TRANSFER_SIZE) {
   		WriteSdi(playBuf, SDI_MAX_TRANSFER_SIZE);
@@ -1137,6 +1739,7 @@ uint8_t VS1053PlayFile(FIL* audio_file) {
   		while (ReadSci(SCI_MODE) & SM_CANCEL)
   			WriteSdi(playBuf, 2);
   	}
+  	WaitSdi();
 
   	/*
   	 * That's it. Now we've played the file as we should, and left VS10xx
@@ -1551,6 +2154,82 @@ const uint16_t chipNumber[16] = {
 	0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/*
+ * Writes two registers and reads them back, twice with all the bits
+ * flipped. Note that if you use a too high SPI speed, the MSB is the most
+ * likely to fail when read again.
+ */
+static uint8_t TestSci(void) {
+	WriteSci(SCI_HDAT0, 0xABAD);
+	WriteSci(SCI_HDAT1, 0x1DEA);
+	if (ReadSci(SCI_HDAT0) != 0xABAD || ReadSci(SCI_HDAT1) != 0x1DEA)
+		return 0;
+	WriteSci(SCI_HDAT0, 0x5452);
+	WriteSci(SCI_HDAT1, 0xE215);
+	return ReadSci(SCI_HDAT0) == 0x5452 && ReadSci(SCI_HDAT1) == 0xE215;
+}
+
+/*
+ * The VS1053's internal clock CLKI for a value of SCI_CLOCKF, leaving the
+ * SC_ADD extra out: XTALI (12.288 MHz if SC_FREQ is 0) multiplied by 1,
+ * 2, 2.5, ... up to 5.
+ */
+static uint32_t VS1053Clock(uint16_t clockf) {
+	static const uint8_t half_multipliers[8] = {2, 4, 5, 6, 7, 8, 9, 10};
+	uint16_t frequency = clockf & SC_FREQ_MASK;
+	uint32_t xtali = frequency ? frequency * 4000 + 8000000 : 12288000;
+
+	return xtali / 2 * half_multipliers[(clockf & SC_MULT_MASK) >> SC_MULT_B];
+}
+
+/*
+ * Index (0 for /2 up to 7 for /256) of the lowest SPI2 prescaler that
+ * doesn't go over "max_hz".
+ */
+static uint8_t FastestPrescaler(uint32_t pclk, uint32_t max_hz) {
+	uint8_t index = 0;
+
+	while (index < 7 && (pclk >> (index + 1)) > max_hz) ++index;
+	return index;
+}
+
+/*
+ * Sets the fastest SPI2 clock that the VS1053 allows with the SCI_CLOCKF
+ * value "clockf": CLKI/4 for SDI and SCI writes, CLKI/7 for SCI reads. If
+ * "verify" is set, the registers test has to pass too, or else the clocks
+ * are slowed down one step at a time until it does. Returns 0 if it never
+ * does.
+ */
+static uint8_t SelectSpiClock(uint16_t clockf, uint8_t verify) {
+	RCC_ClocksTypeDef clocks;
+	uint32_t clki = VS1053Clock(clockf);
+
+	RCC_GetClocksFreq(&clocks);
+	uint8_t write = FastestPrescaler(clocks.PCLK1_Frequency, clki / 4);
+	uint8_t read = FastestPrescaler(clocks.PCLK1_Frequency, clki / 7);
+
+	while (1) {
+		spi_write_prescaler = write << 3;
+		spi_read_prescaler = read << 3;
+		SetSpiPrescaler(spi_write_prescaler);
+		if (!verify || TestSci()) return 1;
+		if (read == 7) return 0;
+		if (write < 7) ++write;
+		++read;
+	}
+}
+
+/*
+ * SPI2 clocks in Hz for SDI and SCI writes and for SCI reads.
+ */
+void GetSpiClocks(uint32_t *write_hz, uint32_t *read_hz) {
+	RCC_ClocksTypeDef clocks;
+
+	RCC_GetClocksFreq(&clocks);
+	*write_hz = clocks.PCLK1_Frequency >> ((spi_write_prescaler >> 3) + 1);
+	*read_hz = clocks.PCLK1_Frequency >> ((spi_read_prescaler >> 3) + 1);
+}
+
 /*
  * Software Initialization for VS1053.
  *
@@ -1560,6 +2239,12 @@ const uint16_t chipNumber[16] = {
 int VSTestInitSoftware(void) {
 	uint16_t ssVer;
 
+	/*
+	 * The VS1053 may have been running faster, but it starts from XTALI
+	 * after the reset below.
+	 */
+	SelectSpiClock(0, 0);
+
 	/*
 	 * Start initialization with a dummy read, which makes sure our
 	 * microcontoller chips selects and everything are where they
@@ -1579,13 +2264,9 @@ int VSTestInitSoftware(void) {
 
 	/*
 	 * A quick sanity check: write to two registers, then test if we
-	 * get the same results. Note that if you use a too high SPI
-	 * speed, the MSB is the most likely to fail when read again.
+	 * get the same results.
 	 */
-	WriteSci(SCI_HDAT0, 0xABAD);
-	WriteSci(SCI_HDAT1, 0x1DEA);
-
-	if (ReadSci(SCI_HDAT0) != 0xABAD || ReadSci(SCI_HDAT1) != 0x1DEA) {
+	if (!TestSci()) {
 		write_phraseLCD("There is something wrong with VS1053", 36, 0, 0, 0x0000, 0xFFFF);
 		return 1;
 	}
@@ -1621,26 +2302,13 @@ int VSTestInitSoftware(void) {
 	/*
 	 * Now when we have upped the VS10xx clock speed, the microcontroller
 	 * SPI bus can run faster. Do that before you start playing or
-	 * recording files.
+	 * recording files. With CLKI = 43.008 MHz that's 42 / 4 = 10.5 MHz
+	 * for writes and 42 / 8 = 5.25 MHz for reads.
 	 */
-	SPI_InitTypeDef New_SPI2_Settings;
-
-	New_SPI2_Settings.SPI_Direction = SPI_Direction_2Lines_FullDuplex;
-	New_SPI2_Settings.SPI_Mode = SPI_Mode_Master;
-	New_SPI2_Settings.SPI_DataSize = SPI_DataSize_8b;
-	New_SPI2_Settings.SPI_CPOL = SPI_CPOL_Low;
-	New_SPI2_Settings.SPI_CPHA = SPI_CPHA_1Edge;
-	New_SPI2_Settings.SPI_NSS = SPI_NSS_Soft | SPI_NSSInternalSoft_Set;
-	/*
-	 * Since the new frequency of VS1053 is 43.008 Mhz, we can transmit with
-	 * frequencies up to 10.752 Mhz. The highest frequency we can allow with APB1
-	 * is 42 / 4 = 10.5 Mhz.
-	 */
-	New_SPI2_Settings.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_4; //or 8
-	New_SPI2_Settings.SPI_FirstBit = SPI_FirstBit_MSB;
-	New_SPI2_Settings.SPI_CRCPolynomial = 7;
-
-	SPI_Init(SPI2, &New_SPI2_Settings);
+	if (!SelectSpiClock(ReadSci(SCI_CLOCKF), 1)) {
+		write_phraseLCD("VS1053 fails at every SPI speed", 31, 0, 0, 0x0000, 0xFFFF);
+		return 1;
+	}
 
 	//Set up other parameters.
 	WriteVS10xxMem(PAR_CONFIG1, PAR_CONFIG1_AAC_SBR_SELECTIVE_UPSAMPLE);
@@ -1667,6 +2335,44 @@ int VSTestInitSoftware(void) {
 	return 0;
 }
 
+/*
+ *  Plays one opened file, showing its name and size, and returns what the
+ *  user wants to do next. The caller closes the file.
+ */
+static uint8_t play_file(FIL* audio_file, char* fileName, uint8_t* volume_set) {
+	struct Media_info media;
+	uint8_t next_action;
+
+	/*
+	 * The probe leaves the file where audio starts, past any
+	 * ID3v2 tag. Files it doesn't know are still played from
+	 * their beginning, the VS1053 may know better.
+	 */
+	if (!probe_media(audio_file, &media)) f_lseek(audio_file, 0);
+	if (attach_link_map(audio_file))
+		readahead_open(audio_file, readahead_depth_for(media.format),
+				media.audio_offset);
+	//set actual volume if necessary
+	if (!mute && !*volume_set) {
+		uint16_t volume_register_value = volume << 8;
+		volume_register_value += volume;
+		WriteSci(SCI_VOL, volume_register_value);
+		*volume_set = 1;
+	}
+	uint32_t size = f_size(audio_file);
+	char size_to_display[11];
+	itoa32bits(size, size_to_display);
+	uint16_t length = write_phraseLCD((char *)fileName, 13, 29, 0, 0x0000, 0xFFFF);
+	paint_areaLCD(length + 1, 0, 250, 31, 0xFFFF);
+	length = write_numberLCD(size_to_display, 11, 240, 0, 0x0000, 0xFFFF);
+	length = write_phraseLCD(" bytes", 6, length + 1, 0, 0x0000, 0xFFFF);
+	paint_areaLCD(length + 1, 0, 450, 23, 0xFFFF);
+	next_action = VS1053PlayFile(audio_file, &media);
+	readahead_close();
+	release_link_map(audio_file);
+	return next_action;
+}
+
 /*
  *  Main function that activates either playback or recording.
  */
@@ -1680,22 +2386,7 @@ int VSTestHandleFile(char *fileName, int record) {
 			FIL audio_file;
 			result = f_open(&audio_file, fileName, FA_READ|FA_OPEN_EXISTING);
 			if (result == FR_OK) {
-				//set actual volume if necessary
-				if (!mute && !volume_set) {
-					uint16_t volume_register_value = volume << 8;
-					volume_register_value += volume;
-					WriteSci(SCI_VOL, volume_register_value);
-					volume_set = 1;
-				}
-				uint32_t size = f_size(&audio_file);
-				char size_to_display[11];
-				itoa32bits(size, size_to_display);
-				uint16_t length = write_phraseLCD((char *)fileName, 13, 29, 0, 0x0000, 0xFFFF);
-				paint_areaLCD(length + 1, 0, 250, 31, 0xFFFF);
-				length = write_numberLCD(size_to_display, 11, 240, 0, 0x0000, 0xFFFF);
-				length = write_phraseLCD(" bytes", 6, length + 1, 0, 0x0000, 0xFFFF);
-				paint_areaLCD(length + 1, 0, 450, 23, 0xFFFF);
-				next_action = VS1053PlayFile(&audio_file);
+				next_action = play_file(&audio_file, fileName, &volume_set);
 				f_close(&audio_file);
 				if (next_action == FORWARD) {
 					uint8_t found_next = 0;
@@ -1704,6 +2395,7 @@ int VSTestHandleFile(char *fileName, int record) {
 					result = f_opendir(&directory, current_directory_path);
 					if (result == FR_OK) {
 						FILINFO next_file;
+						next_file.lfname = 0;
 						result = f_readdir(&directory, &next_file);
 						if (next_file.fname[0] == 0 || result != FR_OK) {
 							found_next = 1;
@@ -1738,6 +2430,7 @@ int VSTestHandleFile(char *fileName, int record) {
 					result = f_opendir(&directory, current_directory_path);
 					if (result == FR_OK) {
 						FILINFO previous_file;
+						previous_file.lfname = 0;
 						result = f_readdir(&directory, &previous_file);
 						if (previous_file.fname[0] == 0 || result != FR_OK) {
 							found_previous = 1;
@@ -1774,6 +2467,7 @@ int VSTestHandleFile(char *fileName, int record) {
 					result = f_opendir(&directory, current_directory_path);
 					if (result == FR_OK) {
 						FILINFO file;
+						file.lfname = 0;
 						result = f_readdir(&directory, &file);
 						if (file.fname[0] == 0 || result != FR_OK) {
 							found = 1;
@@ -1804,6 +2498,7 @@ int VSTestHandleFile(char *fileName, int record) {
 					result = f_opendir(&directory, current_directory_path);
 					if (result == FR_OK) {
 						FILINFO file;
+						file.lfname = 0;
 						result = f_readdir(&directory, &file);
 						if (file.fname[0] == 0 || result != FR_OK) {
 							found = 1;
@@ -1849,3 +2544,125 @@ int VSTestHandleFile(char *fileName, int record) {
 	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
 	return 0;
 }
+
+/*
+ * A file of a tree that was left, kept by its start cluster and size to be
+ * opened again with f_openchain().
+ */
+struct Tree_file {
+	DWORD sclust;
+	DWORD size;
+	char name[13];
+};
+
+static void keep_tree_file(struct Tree_file* kept, FIL* file, char* fileName) {
+	kept->sclust = file->sclust;
+	kept->size = file->fsize;
+	mem_cpy(kept->name, fileName, 13);
+}
+
+static FIL* reopen_tree_file(struct Tree_file* kept, FIL* file, char* fileName) {
+	mem_cpy(fileName, kept->name, 13);
+	return f_openchain(file, kept->sclust, kept->size) == FR_OK ? file : 0;
+}
+
+/*
+ *  Plays every audio file of a directory of the current directory and of its
+ *  subdirectories, see tree.c. FORWARD goes to the next file of the tree and
+ *  BACK to the previous one, FIRST starts the tree again and LAST leaves it.
+ *  The next file is found and opened while the current one plays.
+ *
+ *  The tree is only walked forward, so BACK goes back one file, kept from
+ *  when it was played, and FORWARD then returns to the file BACK left. With
+ *  no previous file BACK plays the current one again.
+ */
+int VSTestPlayTree(char *directory) {
+	char fileName[13];
+	uint8_t next_action = FORWARD;
+	uint8_t volume_set = 0;
+	FIL* audio_file = 0;
+	FIL reopened;
+	struct Tree_file previous, left;
+	uint8_t has_previous = 0;
+	uint8_t has_left = 0;
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	if (!tree_start(directory)) return -1;
+	while (next_action != LEAVE && SDCard_present()) {
+		if (next_action == FORWARD) {
+			if (audio_file) {
+				keep_tree_file(&previous, audio_file, fileName);
+				has_previous = 1;
+				f_close(audio_file);
+			}
+			if (has_left) {
+				has_left = 0;
+				audio_file = reopen_tree_file(&left, &reopened, fileName);
+			}
+			else {
+				audio_file = tree_next(fileName);
+			}
+			if (!audio_file) break;
+		}
+		else if (next_action == BACK) {
+			if (has_previous && !has_left) {
+				keep_tree_file(&left, audio_file, fileName);
+				has_left = 1;
+				has_previous = 0;
+				f_close(audio_file);
+				audio_file = reopen_tree_file(&previous, &reopened, fileName);
+				if (!audio_file) break;
+			}
+			else {
+				f_lseek(audio_file, 0);
+			}
+		}
+		else if (next_action == FIRST) {
+			f_close(audio_file);
+			audio_file = 0;
+			has_previous = has_left = 0;
+			if (!tree_start(directory)) break;
+			next_action = FORWARD;
+			continue;
+		}
+		else break;
+		next_action = play_file(audio_file, fileName, &volume_set);
+	}
+	if (audio_file) f_close(audio_file);
+	tree_stop();
+	WriteSci(SCI_VOL, 0xFEFE);
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	return 0;
+}
+
+/*
+ *  Plays the entries of an M3U or PLS playlist of the current directory, see
+ *  playlist.c. FORWARD and BACK go to the next and the previous entry, FIRST
+ *  and LAST to the first and the last one.
+ */
+int VSTestPlayList(char *playlist) {
+	char fileName[13];
+	uint8_t next_action = FORWARD;
+	uint8_t volume_set = 0;
+	uint16_t index = 0;
+	FIL audio_file;
+
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	if (!playlist_open(playlist)) return -1;
+	while (next_action != LEAVE && SDCard_present()) {
+		if (!playlist_go(index, &audio_file, fileName)) break;
+		next_action = play_file(&audio_file, fileName, &volume_set);
+		f_close(&audio_file);
+		index = playlist_position();
+		if (next_action == FORWARD) ++index;
+		else if (next_action == BACK) {
+			if (index > 0) --index;
+		}
+		else if (next_action == FIRST) index = 0;
+		else if (next_action == LAST) index = PLAYLIST_LAST;
+	}
+	playlist_close();
+	WriteSci(SCI_VOL, 0xFEFE);
+	paint_areaLCD(0, 0, 479, 271, 0xFFFF);
+	return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * PLAYLISTS:
+ * M3U and PLS files list the paths of the songs to play, one per line. In an
+ * M3U file those are the lines that are neither empty nor comments (#EXTINF
+ * and the like), in a PLS file the "FileN=" keys, taken in the order they're
+ * written. Paths can be absolute or relative to the directory of the list,
+ * which is the current directory when it's played, with '/' or '\' and with
+ * or without a drive letter. URLs are skipped, and so are the paths that
+ * can't be opened.
+ *
+ * Following a path means reading every directory on the way, so each entry
+ * is resolved only once, to the start cluster and size of its file, which
+ * are enough to open it again with f_openchain(). Moving to the next or the
+ * previous song is then free of directory reads.
+ *
+ * The playlist file is never loaded whole. It stays open and is read a line
+ * at a time, and the resolved entries are kept for a window of
+ * PLAYLIST_WINDOW_ENTRIES entries. The offset in the file where each window
+ * starts is remembered, so going to another window means seeking there and
+ * resolving its entries again. The player resolves the entries ahead of the
+ * song being played with playlist_prefetch() while it's idle.
+ */
+
+#include <playlist.h>
+#include <utils.h>
+
+static FIL list;
+static uint8_t list_open;
+static uint8_t pls;
+static TCHAR line[PLAYLIST_LINE_LENGTH];
+
+/*
+ * The window: the index in the list of its first entry, how many entries
+ * were resolved and whether the end of the list was reached.
+ */
+static struct Playlist_entry window[PLAYLIST_WINDOW_ENTRIES];
+static uint16_t base;
+static uint16_t count;
+static uint8_t list_end;
+
+/*
+ * Where the windows start in the playlist file, for the first
+ * "windows_known" of them, and the number of entries of the list once it
+ * was read to the end.
+ */
+static DWORD window_offsets[PLAYLIST_WINDOWS];
+static uint8_t windows_known;
+static uint16_t total;
+static uint8_t total_known;
+
+static uint16_t position;
+
+/*
+ * Tells if a file is a playlist by its extension.
+ */
+uint8_t playlist_is_it(char* filename) {
+	return (check_extension(filename, ".M3U", 4) ||
+			check_extension(filename, ".PLS", 4));
+}
+
+static uint8_t is_digit(TCHAR c) {
+	return c >= '0' && c <= '9';
+}
+
+static TCHAR to_upper(TCHAR c) {
+	return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+/*
+ * Finds the path in a line of the list, cleaning it for FatFs. Returns 0 if
+ * the line has none.
+ */
+static TCHAR* entry_path(TCHAR* text) {
+	TCHAR* path;
+	uint16_t length;
+	uint16_t i;
+
+	//UTF-8 byte order mark of the first line
+	if ((BYTE)text[0] == 0xEF && (BYTE)text[1] == 0xBB && (BYTE)text[2] == 0xBF)
+		text += 3;
+	while (*text == ' ' || *text == '\t') ++text;
+	for (length = 0; text[length]; ++length);
+	while (length && (text[length - 1] == '\n' || text[length - 1] == '\r' ||
+			text[length - 1] == ' ' || text[length - 1] == '\t'))
+		text[--length] = 0;
+	if (!length) return 0;
+
+	if (pls) {
+		if (to_upper(text[0]) != 'F' || to_upper(text[1]) != 'I' ||
+				to_upper(text[2]) != 'L' || to_upper(text[3]) != 'E' ||
+				!is_digit(text[4]))
+			return 0;
+		for (text += 4; is_digit(*text); ++text);
+		if (*text++ != '=') return 0;
+	}
+	else if (text[0] == '#') {
+		return 0;
+	}
+
+	path = text;
+	for (i = 0; path[i]; ++i) {
+		if (path[i] == ':' && path[i + 1] == '/' && path[i + 2] == '/') return 0;
+		if (path[i] == '\\') path[i] = '/';
+	}
+	//"C:/..." means the root of the card
+	if (((path[0] >= 'A' && path[0] <= 'Z') || (path[0] >= 'a' && path[0] <= 'z'))
+			&& path[1] == ':')
+		path += 2;
+	return *path ? path : 0;
+}
+
+/*
+ * Keeps the first 12 characters at most of the name of an entry.
+ */
+static void entry_name(struct Playlist_entry* entry, const TCHAR* path) {
+	const TCHAR* name = path;
+	uint8_t i;
+
+	for (; *path; ++path) if (*path == '/') name = path + 1;
+	for (i = 0; i < 12 && name[i]; ++i) entry->name[i] = name[i];
+	entry->name[i] = 0;
+}
+
+/*
+ * Reads lines of the list until one of them is resolved, which is added to
+ * the window. Returns 0 if the window is full or the list ended.
+ */
+static uint8_t resolve_entry() {
+	FIL file;
+
+	if (count == PLAYLIST_WINDOW_ENTRIES || list_end) return 0;
+	while (f_gets(line, PLAYLIST_LINE_LENGTH, &list)) {
+		uint16_t length;
+		TCHAR* path;
+
+		for (length = 0; line[length]; ++length);
+		if (line[length - 1] != '\n' && !f_eof(&list)) {
+			//too long, skip the rest of it
+			while (f_gets(line, PLAYLIST_LINE_LENGTH, &list)) {
+				for (length = 0; line[length]; ++length);
+				if (line[length - 1] == '\n') break;
+			}
+			continue;
+		}
+		path = entry_path(line);
+		if (!path || f_open(&file, path, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+			continue;
+
+		window[count].sclust = file.sclust;
+		window[count].fsize = file.fsize;
+		entry_name(&window[count], path);
+		f_close(&file);
+		if (++count == PLAYLIST_WINDOW_ENTRIES) {
+			uint8_t next = base / PLAYLIST_WINDOW_ENTRIES + 1;
+			if (next < PLAYLIST_WINDOWS && next == windows_known) {
+				window_offsets[next] = f_tell(&list);
+				++windows_known;
+			}
+		}
+		return 1;
+	}
+	list_end = 1;
+	total = base + count;
+	total_known = 1;
+	return 0;
+}
+
+/*
+ * Moves the window to one whose start is known and empties it.
+ */
+static void load_window(uint8_t number) {
+	f_lseek(&list, window_offsets[number]);
+	base = number * PLAYLIST_WINDOW_ENTRIES;
+	count = 0;
+	list_end = 0;
+}
+
+/*
+ * Opens a playlist and resolves its first entry. Returns 0 if it can't be
+ * opened or has no entry that can be played.
+ */
+uint8_t playlist_open(const TCHAR* path) {
+	playlist_close();
+	if (f_open(&list, path, FA_READ | FA_OPEN_EXISTING) != FR_OK) return 0;
+	list_open = 1;
+	pls = check_extension((char*)path, ".PLS", 4);
+	window_offsets[0] = 0;
+	windows_known = 1;
+	total_known = 0;
+	position = 0;
+	load_window(0);
+	if (!resolve_entry()) {
+		playlist_close();
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Resolves the next entry of the window, ahead of the one being played.
+ * Returns 1 if there was one to resolve.
+ */
+uint8_t playlist_prefetch() {
+	if (!list_open) return 0;
+	return resolve_entry();
+}
+
+/*
+ * Opens an entry of the list, by its index or PLAYLIST_LAST, and gives its
+ * name, which "name" must have room for. Returns 0 if the list has no such
+ * entry.
+ */
+uint8_t playlist_go(uint16_t index, FIL* file, char* name) {
+	uint8_t number;
+	struct Playlist_entry* entry;
+
+	if (!list_open) return 0;
+	if (index == PLAYLIST_LAST) {
+		while (!total_known) {
+			if (!resolve_entry() && !list_end) {
+				number = base / PLAYLIST_WINDOW_ENTRIES + 1;
+				if (number == PLAYLIST_WINDOWS) break;
+				load_window(number);
+			}
+		}
+		index = (total_known ? total : base + count) - 1;
+	}
+
+	number = index / PLAYLIST_WINDOW_ENTRIES;
+	if (number >= PLAYLIST_WINDOWS) return 0;
+	while (number != base / PLAYLIST_WINDOW_ENTRIES) {
+		uint8_t known = number < windows_known ? number : windows_known - 1;
+		if (known != base / PLAYLIST_WINDOW_ENTRIES) load_window(known);
+		if (known != number) {
+			while (resolve_entry());
+			if (count < PLAYLIST_WINDOW_ENTRIES) return 0;
+		}
+	}
+	while (index - base >= count)
+		if (!resolve_entry()) return 0;
+
+	entry = &window[index - base];
+	if (f_openchain(file, entry->sclust, entry->fsize) != FR_OK) return 0;
+	mem_cpy(name, entry->name, 13);
+	position = index;
+	return 1;
+}
+
+/*
+ * Index of the entry opened last.
+ */
+uint16_t playlist_position() {
+	return position;
+}
+
+/*
+ * Closes the playlist.
+ */
+void playlist_close() {
+	if (list_open) f_close(&list);
+	list_open = 0;
+}
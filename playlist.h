@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#ifdef _DISK_IMAGE
+#include <stdint.h>
+#else
+#include <stm32f4xx.h>
+#endif
+#include <ff.h>
+
+/*
+ * Entries of the list resolved at a time, and windows of entries whose place
+ * in the playlist file is remembered; lists longer than
+ * PLAYLIST_WINDOWS*PLAYLIST_WINDOW_ENTRIES entries are cut there. The longest
+ * line read from a playlist, longer ones are skipped.
+ */
+#define PLAYLIST_WINDOW_ENTRIES 64
+#define PLAYLIST_WINDOWS 64
+#define PLAYLIST_LINE_LENGTH 256
+
+/*
+ * Index given to playlist_go() for the last entry of the list.
+ */
+#define PLAYLIST_LAST 0xFFFF
+
+/*
+ * An entry of the list once it was found on the card: what's needed to open
+ * it again without reading any directory, and the first 12 characters at
+ * most of its name, to show it.
+ */
+struct Playlist_entry {
+	DWORD sclust;
+	DWORD fsize;
+	char name[13];
+};
+
+uint8_t playlist_is_it(char* filename);
+uint8_t playlist_open(const TCHAR* path);
+uint8_t playlist_prefetch();
+uint8_t playlist_go(uint16_t index, FIL* file, char* name);
+uint16_t playlist_position();
+void playlist_close();
+
+#endif /* PLAYLIST_H */
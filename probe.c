@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * MEDIA PROBE:
+ * The VS1053 finds out the format of a file by itself, but only once it's
+ * being fed with it, and the player used to guess it from the extension of
+ * the name. Here the first sector of the file is read and the format is told
+ * by its magic bytes, so the player knows it before the playback starts and
+ * can choose the read-ahead depth and how many end fill bytes to send. Files
+ * with a wrong extension, or without one, are recognized too.
+ *
+ * MP3 files usually start with an ID3v2 tag, which can take hundreds of
+ * kilobytes with a picture of the cover. Its size is in its header, so the
+ * tag is skipped and the sector after it is probed. The offset where audio
+ * starts is returned, so the tag is never sent to the codec.
+ *
+ * The result is remembered for the last PROBE_CACHE_ENTRIES files, which are
+ * told apart by their first cluster and their size, so a file that is played
+ * again, or probed first by main() and then by the player, is read once.
+ */
+
+#include <probe.h>
+
+/*
+ * A file probed before, by its first cluster and size.
+ */
+struct Probe_cache_entry {
+	DWORD sclust;
+	DWORD size;
+	struct Media_info info;
+};
+
+static struct Probe_cache_entry cache[PROBE_CACHE_ENTRIES];
+static uint8_t next_entry;
+static uint8_t probe_buffer[512] __attribute__ ((aligned (16)));
+
+static uint8_t same_bytes(const uint8_t* data, const char* magic, uint8_t length) {
+	uint8_t i;
+	for (i = 0; i < length; ++i)
+		if (data[i] != (uint8_t)magic[i]) return 0;
+	return 1;
+}
+
+/*
+ * Tells the format of the data that starts at "data", "length" bytes long.
+ * Any zeros before an MPEG or ADTS frame are padding, "offset" is where the
+ * frame starts.
+ */
+static uint8_t sniff(const uint8_t* data, UINT length, uint32_t* offset) {
+	static const char asf_guid[] = "\x30\x26\xB2\x75\x8E\x66\xCF\x11";
+	UINT i = 0;
+
+	*offset = 0;
+	if (length < 12) return MEDIA_UNKNOWN;
+	if (same_bytes(data, "RIFF", 4) && same_bytes(data + 8, "WAVE", 4))
+		return MEDIA_RIFF;
+	if (same_bytes(data, "OggS", 4)) return MEDIA_OGG;
+	if (same_bytes(data, "fLaC", 4)) return MEDIA_FLAC;
+	if (same_bytes(data, "MThd", 4)) return MEDIA_MIDI;
+	if (same_bytes(data, "ADIF", 4)) return MEDIA_AAC_ADIF;
+	if (same_bytes(data + 4, "ftyp", 4)) return MEDIA_M4A;
+	if (same_bytes(data, asf_guid, 8)) return MEDIA_WMA;
+
+	while (i + 4 <= length && data[i] == 0) ++i;
+	if (i + 4 > length || data[i] != 0xFF) return MEDIA_UNKNOWN;
+	*offset = i;
+	data += i;
+	//ADTS: 12 bits of sync, MPEG version and layer 0.
+	if ((data[1] & 0xF6) == 0xF0) return MEDIA_AAC_ADTS;
+	/*
+	 * MPEG audio: 11 bits of sync, then the version, which can't be 01, and
+	 * the layer, which can't be 00. The bitrate index can't be 1111 and the
+	 * sample rate index can't be 11.
+	 */
+	if ((data[1] & 0xE0) != 0xE0 || (data[1] & 0x18) == 0x08
+			|| (data[1] & 0x06) == 0 || (data[2] & 0xF0) == 0xF0
+			|| (data[2] & 0x0C) == 0x0C)
+		return MEDIA_UNKNOWN;
+	switch ((data[1] >> 1) & 0x03) {
+	case 3: return MEDIA_MP1;
+	case 2: return MEDIA_MP2;
+	default: return MEDIA_MP3;
+	}
+}
+
+/*
+ * Forgets the files probed so far, for example because another card was
+ * inserted.
+ */
+void probe_reset() {
+	uint8_t i;
+	for (i = 0; i < PROBE_CACHE_ENTRIES; ++i) cache[i].size = 0;
+	next_entry = 0;
+}
+
+/*
+ * Probes an open file and leaves it at the offset where audio starts. Returns
+ * 1 if its format is known. An empty file is never known.
+ */
+uint8_t probe_media(FIL* file, struct Media_info* info) {
+	uint32_t position = 0;
+	uint32_t offset;
+	uint8_t tags = 0;
+	UINT bytes_read;
+	uint8_t i;
+
+	info->format = MEDIA_UNKNOWN;
+	info->audio_offset = 0;
+	if (!file->fsize) return 0;
+
+	for (i = 0; i < PROBE_CACHE_ENTRIES; ++i) {
+		if (cache[i].size == file->fsize && cache[i].sclust == file->sclust) {
+			*info = cache[i].info;
+			return f_lseek(file, info->audio_offset) == FR_OK
+					&& info->format != MEDIA_UNKNOWN;
+		}
+	}
+
+	while (1) {
+		if (f_lseek(file, position) != FR_OK
+				|| f_read(file, probe_buffer, sizeof(probe_buffer), &bytes_read) != FR_OK)
+			return 0;
+		/*
+		 * An ID3v2 tag: "ID3", the version, the flags and the size of what
+		 * follows the header, 7 bits per byte. A footer, if there is one, is
+		 * 10 bytes more.
+		 */
+		if (bytes_read < 10 || !same_bytes(probe_buffer, "ID3", 3)
+				|| tags == PROBE_MAX_TAGS)
+			break;
+		position += 10 + ((uint32_t)(probe_buffer[6] & 0x7F) << 21)
+				+ ((uint32_t)(probe_buffer[7] & 0x7F) << 14)
+				+ ((uint32_t)(probe_buffer[8] & 0x7F) << 7)
+				+ (probe_buffer[9] & 0x7F);
+		if (probe_buffer[5] & 0x10) position += 10;
+		if (position >= file->fsize) return 0;
+		++tags;
+	}
+
+	info->format = sniff(probe_buffer, bytes_read, &offset);
+	info->audio_offset = (info->format != MEDIA_UNKNOWN) ? position + offset : 0;
+
+	cache[next_entry].sclust = file->sclust;
+	cache[next_entry].size = file->fsize;
+	cache[next_entry].info = *info;
+	next_entry = (next_entry + 1) % PROBE_CACHE_ENTRIES;
+
+	return f_lseek(file, info->audio_offset) == FR_OK
+			&& info->format != MEDIA_UNKNOWN;
+}
+
+/*
+ * Probes the file at "path" without keeping it open.
+ */
+uint8_t probe_path(const TCHAR* path, struct Media_info* info) {
+	FIL file;
+	uint8_t known;
+
+	info->format = MEDIA_UNKNOWN;
+	info->audio_offset = 0;
+	if (f_open(&file, path, FA_READ | FA_OPEN_EXISTING) != FR_OK) return 0;
+	known = probe_media(&file, info);
+	f_close(&file);
+	return known;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#ifdef _DISK_IMAGE
+#include <stdint.h>
+#else
+#include <stm32f4xx.h>
+#endif
+#include <ff.h>
+
+/*
+ * Formats told apart by the probe. They are in the same order as the
+ * AudioFormat enum of player1053.c.
+ */
+#define MEDIA_UNKNOWN 0
+#define MEDIA_RIFF 1
+#define MEDIA_OGG 2
+#define MEDIA_MP1 3
+#define MEDIA_MP2 4
+#define MEDIA_MP3 5
+#define MEDIA_M4A 6
+#define MEDIA_AAC_ADTS 7
+#define MEDIA_AAC_ADIF 8
+#define MEDIA_FLAC 9
+#define MEDIA_WMA 10
+#define MEDIA_MIDI 11
+
+/*
+ * Files whose probe is remembered, and the most ID3v2 tags skipped before the
+ * audio of a file.
+ */
+#define PROBE_CACHE_ENTRIES 16
+#define PROBE_MAX_TAGS 2
+
+/*
+ * What the probe found: the format and the offset of the first byte to send
+ * to the codec, which is past the ID3v2 tags, if any.
+ */
+struct Media_info {
+	uint32_t audio_offset;
+	uint8_t format;
+};
+
+void probe_reset();
+uint8_t probe_media(FIL* file, struct Media_info* info);
+uint8_t probe_path(const TCHAR* path, struct Media_info* info);
+
+#endif /* PROBE_H */
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * READ-AHEAD:
+ * The player used to read a chunk of the song with f_read() and then push it
+ * to the VS1053, so the codec's buffer drained while we waited for the card
+ * and every slow read of the card could be heard. Instead, the next chunks of
+ * the playing file are now read in the background with disk_read_start(),
+ * straight from the sectors of the file into a ring of buffers, while the CPU
+ * is busy feeding the VS1053 with the chunk that was read before.
+ *
+ * The file must have a cluster link map (see attach_link_map() in utils.c),
+ * which gives the sectors of any part of the file without reading the FAT,
+ * see f_mapsect() in ff.c. A chunk may span several fragments of the file,
+ * then it's read with one transfer per fragment. All the bookkeeping is done
+ * by readahead_poll() outside of interrupts: the completion function only
+ * records the result of the transfer.
+ *
+ * If a transfer fails, the same sectors are read again with disk_read(),
+ * which retries them (see diskio.c). If that fails too, the playback ends
+ * like it did when f_read() failed.
+ */
+
+#include <readahead.h>
+#include <probe.h>
+#include <utils.h>
+#include <diskio.h>
+
+#define SLOT_EMPTY 0
+#define SLOT_LOADING 1
+#define SLOT_READY 2
+
+static uint8_t buffers[READAHEAD_MAX_DEPTH][READAHEAD_CHUNK_SIZE] __attribute__ ((aligned (16)));
+static uint8_t slot_state[READAHEAD_MAX_DEPTH];
+static uint32_t slot_length[READAHEAD_MAX_DEPTH];
+
+static FIL* file;				//Playing file, 0 if the read-ahead is off.
+static uint8_t depth;			//Slots in use for this file.
+static uint8_t head;			//Next slot to hand to the player.
+static uint8_t tail;			//Next slot to load.
+static uint8_t filled;			//Slots loading or ready.
+static int8_t loading;			//Slot being loaded, -1 if none.
+static int8_t handed_out;		//Slot the player is using, -1 if none.
+static uint32_t fetch_offset;	//File offset of the chunk being loaded or next.
+static uint32_t skip;			//Bytes to skip in the first chunk after a seek.
+static uint8_t priming;			//No chunk was handed out since the last seek.
+static uint8_t read_error;
+
+/*
+ * Transfer in progress: "run_sectors" sectors from "run_sector" into the
+ * loading slot, after the "loaded_sectors" that are already there.
+ */
+static volatile uint8_t transfer_busy;
+static volatile DRESULT transfer_result;
+static DWORD run_sector;
+static UINT run_sectors;
+static UINT loaded_sectors;
+
+static struct Readahead_stats stats;
+
+/*
+ * Chooses how many chunks to read ahead for a file from its format, as found
+ * by probe_media().
+ */
+uint8_t readahead_depth_for(uint8_t format) {
+	if (format == MEDIA_FLAC || format == MEDIA_RIFF)
+		return READAHEAD_DEPTH_LOSSLESS;
+	return READAHEAD_DEPTH_COMPRESSED;
+}
+
+static void transfer_done(DRESULT result) {
+	transfer_result = result;
+	transfer_busy = 0;
+}
+
+static void wait_transfer() {
+	while (transfer_busy);
+}
+
+/*
+ * Bytes of the chunk at fetch_offset, the last one of the file may be
+ * shorter.
+ */
+static uint32_t chunk_length() {
+	uint32_t length = f_size(file) - fetch_offset;
+	return length > READAHEAD_CHUNK_SIZE ? READAHEAD_CHUNK_SIZE : length;
+}
+
+/*
+ * Starts reading the next fragment of the chunk in the loading slot.
+ */
+static void start_run() {
+	UINT sectors = (chunk_length() + 511) / 512 - loaded_sectors;
+
+	if (f_mapsect(file, fetch_offset + loaded_sectors * 512, &run_sector,
+			&run_sectors) != FR_OK) {
+		read_error = 1;
+		return;
+	}
+	if (run_sectors > sectors) run_sectors = sectors;
+
+	transfer_busy = 1;
+	if (disk_read_start(0, buffers[loading] + loaded_sectors * 512, run_sector,
+			run_sectors, transfer_done) != RES_OK) {
+		transfer_result = RES_ERROR;
+		transfer_busy = 0;
+	}
+}
+
+/*
+ * Keeps the ring of chunks full. It should be called often while the player
+ * feeds the VS1053, it returns right away if there's nothing to do.
+ */
+void readahead_poll() {
+	if (!file || transfer_busy || read_error) return;
+
+	if (loading >= 0) {
+		//The last transfer that was started has finished.
+		if (transfer_result != RES_OK && disk_read(0, buffers[loading] +
+				loaded_sectors * 512, run_sector, run_sectors) != RES_OK) {
+			read_error = 1;
+			return;
+		}
+		loaded_sectors += run_sectors;
+		if (loaded_sectors * 512 < chunk_length()) {
+			start_run();
+			return;
+		}
+		slot_length[loading] = chunk_length();
+		slot_state[loading] = SLOT_READY;
+		fetch_offset += READAHEAD_CHUNK_SIZE;
+		loading = -1;
+	}
+
+	if (filled < depth && fetch_offset < f_size(file)) {
+		loading = tail;
+		tail = (tail + 1) % depth;
+		slot_state[loading] = SLOT_LOADING;
+		++filled;
+		loaded_sectors = 0;
+		start_run();
+	}
+}
+
+/*
+ * Starts reading ahead an open file, from "offset", keeping "depth" chunks.
+ * Returns 0 if it's not possible, the file must then be read with f_read() as
+ * usual.
+ */
+uint8_t readahead_open(FIL* audio_file, uint8_t chunks, uint32_t offset) {
+	readahead_close();
+	if (!audio_file->cltbl || chunks == 0) return 0;
+	if (chunks > READAHEAD_MAX_DEPTH) chunks = READAHEAD_MAX_DEPTH;
+
+	file = audio_file;
+	depth = chunks;
+	stats.chunks = 0;
+	stats.stalls = 0;
+	return readahead_seek(offset);
+}
+
+/*
+ * Stops reading ahead, waiting for the transfer in progress.
+ */
+void readahead_close() {
+	wait_transfer();
+	file = 0;
+}
+
+uint8_t readahead_active() {
+	return file != 0;
+}
+
+/*
+ * Drops the chunks read so far and continues reading from "offset".
+ */
+uint8_t readahead_seek(uint32_t offset) {
+	uint8_t i;
+
+	if (!file) return 0;
+	wait_transfer();
+
+	for (i = 0; i < READAHEAD_MAX_DEPTH; ++i)
+		slot_state[i] = SLOT_EMPTY;
+	head = tail = filled = 0;
+	loading = handed_out = -1;
+	read_error = 0;
+	fetch_offset = offset - offset % READAHEAD_CHUNK_SIZE;
+	skip = offset - fetch_offset;
+	priming = 1;
+
+	readahead_poll();
+	return 1;
+}
+
+/*
+ * Hands the next chunk of the file to the player: "data" points to it and
+ * the number of bytes is returned, 0 at the end of the file or after an
+ * error. The chunk stays valid until the next call.
+ */
+uint32_t readahead_next(uint8_t** data) {
+	uint8_t waited = 0;
+
+	if (!file) return 0;
+
+	if (handed_out >= 0) {
+		slot_state[handed_out] = SLOT_EMPTY;
+		--filled;
+		head = (head + 1) % depth;
+		handed_out = -1;
+	}
+
+	while (slot_state[head] != SLOT_READY) {
+		if (read_error || (!filled && fetch_offset >= f_size(file))) return 0;
+		readahead_poll();
+		waited = 1;
+	}
+	if (waited && !priming) ++stats.stalls;
+	priming = 0;
+	readahead_poll();
+
+	++stats.chunks;
+	handed_out = head;
+	*data = buffers[head] + skip;
+	uint32_t length = slot_length[head] - skip;
+	skip = 0;
+	return length;
+}
+
+void readahead_get_stats(struct Readahead_stats* readahead_stats) {
+	*readahead_stats = stats;
+}
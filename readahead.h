@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stm32f4xx.h>
+#include <ff.h>
+
+/*
+ * The playing file is read ahead in chunks of READAHEAD_CHUNK_SIZE bytes,
+ * keeping up to READAHEAD_MAX_DEPTH of them in RAM. How many are actually
+ * kept depends on the format: compressed formats need a few kilobytes per
+ * second, while FLAC and WAV need hundreds.
+ */
+#define READAHEAD_CHUNK_SIZE 4096
+#define READAHEAD_MAX_DEPTH 8
+#define READAHEAD_DEPTH_COMPRESSED 3
+#define READAHEAD_DEPTH_LOSSLESS 8
+
+/*
+ * Chunks handed to the player since the file was opened, and how many times
+ * the player had to wait for the card because the next chunk wasn't there.
+ */
+struct Readahead_stats {
+	uint32_t chunks;
+	uint32_t stalls;
+};
+
+uint8_t readahead_depth_for(uint8_t format);
+uint8_t readahead_open(FIL* file, uint8_t depth, uint32_t offset);
+void readahead_close();
+uint8_t readahead_active();
+void readahead_poll();
+uint32_t readahead_next(uint8_t** data);
+uint8_t readahead_seek(uint32_t offset);
+void readahead_get_stats(struct Readahead_stats* stats);
+
+#endif /* READAHEAD_H */
@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * TAGS:
+ * The file manager shows the title, the artist and the duration of the audio
+ * files on screen. Finding them means opening the file and reading a sector
+ * or two, which is too slow to do for 10 rows before showing them, so the
+ * rows are shown with their names first and the file manager asks for the
+ * tags of one row at a time while it's idle (see file_manager() in apps.c).
+ *
+ * What was found is kept for the last TAGS_CACHE_ENTRIES files, told apart by
+ * the start cluster of their directory and their 8.3 name, so scrolling back
+ * and forth shows the tags right away. When the cache is full, the entry that
+ * was used longest ago is replaced.
+ *
+ * Those formats are understood:
+ * - MP3 with an ID3v2 tag (versions 2.2 to 2.4): the TIT2, TPE1 and TLEN
+ *   frames, or TT2, TP1 and TLE. Without TLEN the duration comes from the
+ *   Xing or Info header of the first frame, which variable bitrate files
+ *   have, or from the bitrate of the first frame.
+ * - FLAC: the duration from STREAMINFO, the title and the artist from the
+ *   Vorbis comment, if it's in the first TAGS_READ_SIZE bytes.
+ * - WAV: the duration from the byte rate of the fmt chunk.
+ */
+
+#include <tags.h>
+#include <probe.h>
+
+/*
+ * Tags of a file and when they were used, in calls to tags_find() and
+ * tags_load(). An entry that was never used has "used" 0.
+ */
+struct Tags_cache_entry {
+	DWORD directory;
+	char name[12];
+	uint32_t used;
+	struct Tags tags;
+};
+
+static struct Tags_cache_entry cache[TAGS_CACHE_ENTRIES];
+static uint32_t use_clock;
+static uint8_t buffer[TAGS_READ_SIZE] __attribute__ ((aligned (16)));
+
+/*
+ * Bitrates of MPEG layer III in kbit/s, for MPEG 1 and for MPEG 2 and 2.5,
+ * and sample rates in Hz for MPEG 1. MPEG 2 has half of them and MPEG 2.5 a
+ * quarter.
+ */
+static const uint16_t bitrates[2][16] = {
+	{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+	{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}
+};
+static const uint16_t sample_rates[4] = {44100, 48000, 32000, 0};
+
+static uint8_t same_name(const char* a, const char* b) {
+	uint8_t i;
+	for (i = 0; i < 12; ++i) {
+		if (a[i] != b[i]) return 0;
+		if (!a[i]) break;
+	}
+	return 1;
+}
+
+static uint32_t big_endian(const uint8_t* data, uint8_t bytes) {
+	uint32_t value = 0;
+	while (bytes--) value = (value << 8) | *data++;
+	return value;
+}
+
+static uint32_t little_endian(const uint8_t* data, uint8_t bytes) {
+	uint32_t value = 0;
+	while (bytes--) value = (value << 8) | data[bytes];
+	return value;
+}
+
+static uint32_t syncsafe(const uint8_t* data) {
+	return ((uint32_t)(data[0] & 0x7F) << 21) | ((uint32_t)(data[1] & 0x7F) << 14)
+			| ((uint32_t)(data[2] & 0x7F) << 7) | (data[3] & 0x7F);
+}
+
+/*
+ * Copies a text to "text", keeping what's ASCII and replacing anything else
+ * with '?'. "wide" is 1 for UTF-16 little endian and 2 for big endian, where
+ * only one of every two bytes is a character.
+ */
+static void copy_text(char* text, const uint8_t* data, uint32_t length,
+		uint8_t wide) {
+	uint8_t i = 0;
+	uint32_t j;
+
+	for (j = 0; j < length && i < TAGS_TEXT_LENGTH - 1; ) {
+		uint16_t letter = data[j];
+		if (wide) {
+			if (j + 1 >= length) break;
+			letter = (wide == 1) ? data[j] | (data[j + 1] << 8)
+					: (data[j] << 8) | data[j + 1];
+			j += 2;
+		}
+		else ++j;
+		if (!letter) break;
+		if (letter == 0xFEFF || letter == 0xFFFE) continue;
+		text[i++] = (letter >= 32 && letter < 127) ? letter : '?';
+	}
+	text[i] = 0;
+}
+
+/*
+ * Copies an ID3v2 text frame, whose first byte tells the encoding: 0 for
+ * ISO-8859-1, 1 for UTF-16 with a byte order mark, 2 for UTF-16 big endian
+ * and 3 for UTF-8.
+ */
+static void copy_frame_text(char* text, const uint8_t* data, uint32_t length) {
+	uint8_t wide = 0;
+
+	if (!length) return;
+	if (data[0] == 1)
+		wide = (length >= 3 && data[1] == 0xFE) ? 2 : 1;
+	else if (data[0] == 2)
+		wide = 2;
+	copy_text(text, data + 1, length - 1, wide);
+}
+
+/*
+ * Tells if an ID3v2 frame has the ID "old_id" in version 2.2, where IDs have 3
+ * characters, or "id" in the later ones.
+ */
+static uint8_t frame_is(const uint8_t* frame, uint8_t version,
+		const char* old_id, const char* id) {
+	const char* wanted = (version == 2) ? old_id : id;
+	uint8_t i;
+	for (i = 0; wanted[i]; ++i)
+		if (frame[i] != (uint8_t)wanted[i]) return 0;
+	return 1;
+}
+
+/*
+ * Reads the frames of an ID3v2 tag from "buffer", which holds "length" bytes
+ * from the beginning of the file. Returns the duration from TLEN, in
+ * seconds, or 0.
+ */
+static uint16_t read_id3(struct Tags* tags, UINT length) {
+	uint8_t version = buffer[3];
+	uint8_t header = (version == 2) ? 6 : 10;
+	uint32_t end = 10 + syncsafe(buffer + 6);
+	uint32_t position = 10;
+	uint16_t seconds = 0;
+
+	if (version < 2 || version > 4) return 0;
+	if (end > length) end = length;
+	//An extended header is skipped, its size is counted differently in 2.3.
+	if (version > 2 && (buffer[5] & 0x40) && position + 4 <= end)
+		position += (version == 4) ? syncsafe(buffer + position)
+				: big_endian(buffer + position, 4) + 4;
+
+	while (position + header <= end && buffer[position]) {
+		const uint8_t* frame = buffer + position;
+		uint32_t size;
+		if (version == 2) size = big_endian(frame + 3, 3);
+		else if (version == 4) size = syncsafe(frame + 4);
+		else size = big_endian(frame + 4, 4);
+		position += header;
+		if (size > end - position) size = end - position;
+
+		if (frame_is(frame, version, "TT2", "TIT2"))
+			copy_frame_text(tags->title, buffer + position, size);
+		else if (frame_is(frame, version, "TP1", "TPE1"))
+			copy_frame_text(tags->artist, buffer + position, size);
+		else if (frame_is(frame, version, "TLE", "TLEN")) {
+			char digits[TAGS_TEXT_LENGTH];
+			uint32_t milliseconds = 0;
+			uint8_t i;
+			copy_frame_text(digits, buffer + position, size);
+			for (i = 0; digits[i] >= '0' && digits[i] <= '9'; ++i)
+				milliseconds = milliseconds * 10 + digits[i] - '0';
+			seconds = milliseconds / 1000;
+		}
+		position += size;
+	}
+	return seconds;
+}
+
+/*
+ * Finds the duration of an MP3 file from its first frame, which is at
+ * "offset". Variable bitrate files have a Xing or Info header there with the
+ * number of frames, otherwise the bitrate is taken as constant.
+ */
+static uint16_t mp3_duration(FIL* file, uint32_t offset) {
+	uint8_t mpeg1, mono;
+	uint32_t bitrate, sample_rate, frames;
+	uint8_t* xing;
+	UINT bytes_read;
+
+	if (f_lseek(file, offset) != FR_OK
+			|| f_read(file, buffer, 64, &bytes_read) != FR_OK || bytes_read < 64)
+		return 0;
+	mpeg1 = (buffer[1] & 0x18) == 0x18;
+	mono = (buffer[3] & 0xC0) == 0xC0;
+	bitrate = bitrates[mpeg1 ? 0 : 1][buffer[2] >> 4];
+	sample_rate = sample_rates[(buffer[2] >> 2) & 0x03];
+	if (!mpeg1) sample_rate /= ((buffer[1] & 0x18) == 0x10) ? 2 : 4;
+	if (!sample_rate) return 0;
+
+	//The Xing header follows the side information, whose size depends on the frame.
+	xing = buffer + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+	if ((xing[0] == 'X' && xing[1] == 'i' && xing[2] == 'n' && xing[3] == 'g')
+			|| (xing[0] == 'I' && xing[1] == 'n' && xing[2] == 'f' && xing[3] == 'o')) {
+		if (xing[7] & 0x01) {
+			frames = big_endian(xing + 8, 4);
+			return frames * (mpeg1 ? 1152 : 576) / sample_rate;
+		}
+	}
+	if (!bitrate) return 0;
+	return (f_size(file) - offset) / (bitrate * 125);
+}
+
+/*
+ * Tells if a Vorbis comment, "size" bytes long, begins with "name", which is
+ * in capitals and ends with '='. The case of the comment doesn't matter.
+ */
+static uint8_t comment_is(const uint8_t* comment, uint32_t size, const char* name) {
+	uint8_t i;
+	for (i = 0; name[i]; ++i) {
+		uint8_t letter;
+		if (i >= size) return 0;
+		letter = comment[i];
+		if (letter >= 'a' && letter <= 'z') letter -= 'a' - 'A';
+		if (letter != (uint8_t)name[i]) return 0;
+	}
+	return 1;
+}
+
+/*
+ * Reads the metadata blocks of a FLAC file, which start at "offset" with
+ * "fLaC".
+ */
+static void read_flac(FIL* file, uint32_t offset, struct Tags* tags) {
+	uint32_t position = offset + 4;
+	UINT bytes_read;
+	uint8_t last = 0;
+
+	while (!last) {
+		uint8_t type;
+		uint32_t length;
+		if (f_lseek(file, position) != FR_OK
+				|| f_read(file, buffer, TAGS_READ_SIZE, &bytes_read) != FR_OK
+				|| bytes_read < 4)
+			return;
+		last = buffer[0] & 0x80;
+		type = buffer[0] & 0x7F;
+		length = big_endian(buffer + 1, 3);
+		/*
+		 * STREAMINFO: 20 bits of sample rate at byte 10 of the block, then
+		 * channels and bits per sample, then 36 bits of total samples.
+		 */
+		if (type == 0 && bytes_read >= 4 + 18) {
+			const uint8_t* info = buffer + 4;
+			uint32_t sample_rate = big_endian(info + 10, 3) >> 4;
+			uint32_t samples = big_endian(info + 14, 4);
+			if (sample_rate && !(info[13] & 0x0F)) tags->seconds = samples / sample_rate;
+		}
+		/*
+		 * VORBIS_COMMENT, in little endian: the vendor string, the number of
+		 * comments and every comment as "NAME=value".
+		 */
+		else if (type == 4) {
+			uint32_t end = (4 + length < bytes_read) ? 4 + length : bytes_read;
+			uint32_t at = 4;
+			uint32_t comments;
+			if (at + 4 > end) return;
+			at += 4 + little_endian(buffer + at, 4);
+			if (at + 4 > end) return;
+			comments = little_endian(buffer + at, 4);
+			at += 4;
+			while (comments-- && at + 4 <= end) {
+				uint32_t size = little_endian(buffer + at, 4);
+				const uint8_t* comment = buffer + at + 4;
+				at += 4;
+				if (size > end - at) size = end - at;
+				if (comment_is(comment, size, "TITLE="))
+					copy_text(tags->title, comment + 6, size - 6, 0);
+				else if (comment_is(comment, size, "ARTIST="))
+					copy_text(tags->artist, comment + 7, size - 7, 0);
+				at += size;
+			}
+			return;
+		}
+		position += 4 + length;
+	}
+}
+
+/*
+ * Reads the tags of an open file.
+ */
+static void read_tags(FIL* file, struct Tags* tags) {
+	struct Media_info media;
+	UINT bytes_read;
+
+	probe_media(file, &media);
+	if (media.format == MEDIA_MP3) {
+		if (f_lseek(file, 0) != FR_OK
+				|| f_read(file, buffer, TAGS_READ_SIZE, &bytes_read) != FR_OK)
+			return;
+		if (bytes_read >= 10 && buffer[0] == 'I' && buffer[1] == 'D' && buffer[2] == '3')
+			tags->seconds = read_id3(tags, bytes_read);
+		if (!tags->seconds) tags->seconds = mp3_duration(file, media.audio_offset);
+	}
+	else if (media.format == MEDIA_FLAC) {
+		read_flac(file, media.audio_offset, tags);
+	}
+	/*
+	 * WAV: the byte rate is at byte 28 of a canonical header, and what's not
+	 * the 44 bytes of header is audio.
+	 */
+	else if (media.format == MEDIA_RIFF) {
+		if (f_lseek(file, 0) != FR_OK
+				|| f_read(file, buffer, 44, &bytes_read) != FR_OK || bytes_read < 44)
+			return;
+		if (little_endian(buffer + 28, 4))
+			tags->seconds = (f_size(file) - 44) / little_endian(buffer + 28, 4);
+	}
+}
+
+/*
+ * Forgets all the tags, for example because another card was inserted.
+ */
+void tags_reset() {
+	uint8_t i;
+	for (i = 0; i < TAGS_CACHE_ENTRIES; ++i) cache[i].used = 0;
+	use_clock = 0;
+}
+
+/*
+ * Gets the tags of a file of the directory starting at cluster "directory"
+ * if they were already read, or 0 otherwise.
+ */
+const struct Tags* tags_find(DWORD directory, const char* name) {
+	uint8_t i;
+
+	for (i = 0; i < TAGS_CACHE_ENTRIES; ++i) {
+		if (cache[i].used && cache[i].directory == directory
+				&& same_name(cache[i].name, name)) {
+			cache[i].used = ++use_clock;
+			return &cache[i].tags;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Reads the tags of a file of the current directory, which starts at cluster
+ * "directory", and keeps them in place of the ones used longest ago. If the
+ * file can't be read, it's kept with no tags, so it's not read again.
+ */
+const struct Tags* tags_load(DWORD directory, const char* name) {
+	struct Tags_cache_entry* entry = &cache[0];
+	FIL file;
+	uint8_t i;
+
+	for (i = 1; i < TAGS_CACHE_ENTRIES; ++i)
+		if (cache[i].used < entry->used) entry = &cache[i];
+
+	entry->directory = directory;
+	for (i = 0; i < 12; ++i) entry->name[i] = name[i];
+	entry->used = ++use_clock;
+	entry->tags.title[0] = 0;
+	entry->tags.artist[0] = 0;
+	entry->tags.seconds = 0;
+	if (f_open(&file, name, FA_READ | FA_OPEN_EXISTING) == FR_OK) {
+		read_tags(&file, &entry->tags);
+		f_close(&file);
+	}
+	return &entry->tags;
+}
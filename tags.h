@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TAGS_H
+#define TAGS_H
+
+#ifdef _DISK_IMAGE
+#include <stdint.h>
+#else
+#include <stm32f4xx.h>
+#endif
+#include <ff.h>
+
+/*
+ * Files whose tags are remembered, the longest title or artist kept, and the
+ * bytes read at most from the beginning of a tag.
+ */
+#define TAGS_CACHE_ENTRIES 32
+#define TAGS_TEXT_LENGTH 32
+#define TAGS_READ_SIZE 1024
+
+/*
+ * What is shown of an audio file in the file manager. The title and the
+ * artist are ASCII and end with a zero, they are empty if unknown. The
+ * duration is 0 if unknown.
+ */
+struct Tags {
+	char title[TAGS_TEXT_LENGTH];
+	char artist[TAGS_TEXT_LENGTH];
+	uint16_t seconds;
+};
+
+void tags_reset();
+const struct Tags* tags_find(DWORD directory, const char* name);
+const struct Tags* tags_load(DWORD directory, const char* name);
+
+#endif /* TAGS_H */
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2014, Daniel Flores Tafur
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * TREE PLAYBACK:
+ * The player plays the audio files of one directory, this module gives it the
+ * audio files of a whole directory tree instead, one after another, so a
+ * library with one folder per album plays from end to end. The tree is walked
+ * depth first, in the order the entries have in their directories, keeping
+ * one DIR per level in an explicit stack, and what's deeper than
+ * TREE_MAX_DEPTH levels is skipped.
+ *
+ * Looking for the next file between two songs would mean a silence while the
+ * directories are read, so the walk goes on while the current song plays:
+ * the player calls tree_prefetch() when it's idle, which reads a few entries
+ * at a time until the next audio file is found and then opens it. When the
+ * song ends the next file is already open, it's in the second of two FIL
+ * objects used in turns.
+ *
+ * The files are opened with their paths relative to the current directory,
+ * so FatFs' current directory is never changed.
+ */
+
+#include <tree.h>
+#include <utils.h>
+
+//Directories being walked, one per level, and their paths.
+static DIR stack[TREE_MAX_DEPTH];
+static char path[TREE_MAX_DEPTH * 13 + 13 + 1];
+static uint16_t path_length[TREE_MAX_DEPTH];
+static int8_t level = -1;
+
+/*
+ * The file being played and the next one, which is in slots[next_slot] and
+ * named next_name if "prefetched" is set.
+ */
+static FIL slots[2];
+static uint8_t next_slot;
+static uint8_t prefetched;
+static char next_name[13];
+
+/*
+ * Appends a name to the path of the current level.
+ */
+static uint16_t append_name(const char* name) {
+	uint16_t length = path_length[level];
+	uint8_t i;
+
+	path[length++] = '/';
+	for (i = 0; i < 13 && name[i]; ++i) path[length++] = name[i];
+	path[length] = 0;
+	return length;
+}
+
+/*
+ * Starts playing the tree of a directory of the current directory. Returns 0
+ * if it can't be opened.
+ */
+uint8_t tree_start(const TCHAR* directory) {
+	uint8_t i;
+
+	tree_stop();
+	for (i = 0; i < 13 && directory[i]; ++i) path[i] = directory[i];
+	path[i] = 0;
+	if (f_opendir(&stack[0], path) != FR_OK) return 0;
+	level = 0;
+	path_length[0] = i;
+	return 1;
+}
+
+/*
+ * Goes on walking the tree for at most TREE_STEP_ENTRIES entries, or until
+ * the next audio file is found and opened. Returns 1 if there was anything to
+ * do.
+ */
+uint8_t tree_prefetch() {
+	FILINFO info;
+	uint8_t count;
+
+	if (prefetched || level < 0) return 0;
+	info.lfname = 0;
+	for (count = 0; count < TREE_STEP_ENTRIES && level >= 0; ++count) {
+		if (f_readdir(&stack[level], &info) != FR_OK || !info.fname[0]) {
+			--level;
+			continue;
+		}
+		if (info.fname[0] == '.' || (info.fattrib & (AM_SYS | AM_HID))) continue;
+
+		if (info.fattrib & AM_DIR) {
+			if (level + 1 < TREE_MAX_DEPTH) {
+				uint16_t length = append_name(info.fname);
+				if (f_opendir(&stack[level + 1], path) == FR_OK) {
+					++level;
+					path_length[level] = length;
+				}
+			}
+		}
+		else if (is_it_audio(info.fname)) {
+			append_name(info.fname);
+			if (f_open(&slots[next_slot], path, FA_READ | FA_OPEN_EXISTING) == FR_OK) {
+				mem_cpy(next_name, info.fname, 13);
+				prefetched = 1;
+				break;
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+ * Gets the next file of the tree, opened, and its 8.3 name, which "name"
+ * must have room for. If it wasn't prefetched yet, the walk is finished now.
+ * The caller closes the file. Returns 0 once the whole tree was played.
+ */
+FIL* tree_next(char* name) {
+	FIL* file;
+
+	while (!prefetched && level >= 0) tree_prefetch();
+	if (!prefetched) return 0;
+
+	file = &slots[next_slot];
+	mem_cpy(name, next_name, 13);
+	next_slot ^= 1;
+	prefetched = 0;
+	return file;
+}
+
+/*
+ * Stops playing the tree, closing the file that was prefetched, if any.
+ */
+void tree_stop() {
+	if (prefetched) f_close(&slots[next_slot]);
+	prefetched = 0;
+	level = -1;
+}
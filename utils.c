@@ -128,10 +128,69 @@ void itoa32bits(uint32_t number, char* ascii) {
 	ascii[i] = j + 48;
 }
 
+/*
+ * Tells from its name if a file is likely to be audio, which is all that can
+ * be done while going through a directory without opening every file. A file
+ * that is going to be played is probed by its contents (see probe.c), so the
+ * list holds the extensions of every format the probe knows.
+ */
 int is_it_audio(char* filename) {
 	return (check_extension(filename, ".WAV", 4) ||
 			check_extension(filename, ".MP3", 4) ||
+			check_extension(filename, ".MP2", 4) ||
 			check_extension(filename, ".FLA", 4) ||
 			check_extension(filename, ".WMA", 4) ||
-			check_extension(filename, ".M4A", 4));
+			check_extension(filename, ".M4A", 4) ||
+			check_extension(filename, ".AAC", 4) ||
+			check_extension(filename, ".OGG", 4) ||
+			check_extension(filename, ".MID", 4));
+}
+
+/*
+ * FAST SEEK:
+ * FatFs only knows where the first cluster of a file is, the rest of them are
+ * found following the chain in the FAT. So every time we seek backwards or
+ * far forward in a file, FatFs has to walk the chain cluster by cluster, which
+ * for a big file means reading dozens of FAT sectors from the card. With fast
+ * seek enabled (_USE_FASTSEEK in ffconf.h) FatFs can instead use a cluster
+ * link map table (CLMT), which lists the fragments of the file as pairs of
+ * length and first cluster, so any position is found without any card access.
+ *
+ * The tables are taken from a small fixed pool, since there are only so many
+ * files open at a time. If the pool is exhausted or the file is too fragmented
+ * for a table the file is simply used without a map.
+ */
+static DWORD link_maps[LINK_MAP_POOL_SIZE][LINK_MAP_ENTRIES];
+static FIL* link_map_owners[LINK_MAP_POOL_SIZE];
+
+/*
+ * Builds a link map for an open file. Returns 1 if the file has a map now.
+ */
+uint8_t attach_link_map(FIL* file) {
+	uint8_t i;
+
+	for (i = 0; i < LINK_MAP_POOL_SIZE && link_map_owners[i] != 0; ++i);
+	if (i == LINK_MAP_POOL_SIZE) return 0;
+
+	link_maps[i][0] = LINK_MAP_ENTRIES;
+	file->cltbl = link_maps[i];
+	if (f_lseek(file, CREATE_LINKMAP) != FR_OK) {
+		file->cltbl = 0;
+		return 0;
+	}
+
+	link_map_owners[i] = file;
+	return 1;
+}
+
+/*
+ * Gives back the link map of a file, it must be called before closing it.
+ */
+void release_link_map(FIL* file) {
+	uint8_t i;
+
+	for (i = 0; i < LINK_MAP_POOL_SIZE; ++i) {
+		if (link_map_owners[i] == file) link_map_owners[i] = 0;
+	}
+	file->cltbl = 0;
 }
@@ -28,6 +28,15 @@
 #define UTILS_H
 
 #include <stm32f4xx.h>
+#include <ff.h>
+
+/*
+ * Cluster link map tables for fast seeking in open files, see utils.c. Each
+ * table can describe a file made of up to (LINK_MAP_ENTRIES - 2) / 2
+ * fragments.
+ */
+#define LINK_MAP_POOL_SIZE 2
+#define LINK_MAP_ENTRIES 64
 
 uint8_t SDCard_present();
 uint8_t check_extension(char *filename, char* extension,
@@ -38,5 +47,7 @@ void itoa_time_segment(uint8_t number, char* ascii);
 void itoa16bits(uint16_t number, char* ascii);
 void itoa32bits(uint32_t number, char* ascii);
 int is_it_audio(char* filename);
+uint8_t attach_link_map(FIL* file);
+void release_link_map(FIL* file);
 
 #endif /* UTILS_H */